@@ -0,0 +1,121 @@
+/**
+ * @file accounting.h
+ *
+ * Optional self-accounting of the time spent logging.
+ *
+ * If `L3PP_ENABLE_ACCOUNTING` is defined, one out of every
+ * Accounting::getSampleRate() log entries of a thread is timed, from the
+ * creation of the entry until it was passed to all sinks. The sampled times
+ * are extrapolated and compared to the CPU time of the thread, such that the
+ * share of CPU time spent logging can be reported per thread and logger.
+ * Entries formatted and written by the workers of an AsyncSink are sampled on
+ * the worker threads in the same way.
+ */
+
+#pragma once
+
+#ifdef L3PP_ENABLE_ACCOUNTING
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace l3pp {
+
+/**
+ * Estimated logging overhead of a single thread.
+ */
+struct ThreadOverhead {
+	/// Id of the thread.
+	std::thread::id thread;
+	/// Whether the thread is still running.
+	bool running;
+	/// CPU time used by the thread since accounting started.
+	std::chrono::nanoseconds cpuTime;
+	/// Estimated time spent logging, by logger name.
+	std::map<std::string, std::chrono::nanoseconds> loggers;
+
+	/**
+	 * Estimated time spent logging to any logger.
+	 */
+	std::chrono::nanoseconds logTime() const;
+
+	/**
+	 * Percentage of CPU time spent logging to any logger.
+	 */
+	double percentage() const;
+
+	/**
+	 * Percentage of CPU time spent logging to the given logger.
+	 */
+	double percentage(std::string const& logger) const;
+};
+
+/**
+ * Controls and reports the logging overhead accounting.
+ */
+class Accounting {
+public:
+	/**
+	 * Sets the sampling rate, i.e. one out of rate entries is timed.
+	 */
+	static void setSampleRate(unsigned rate);
+
+	static unsigned getSampleRate();
+
+	/**
+	 * Collects the overhead of all threads that have logged since the last
+	 * reset().
+	 */
+	static std::vector<ThreadOverhead> report();
+
+	/**
+	 * Prints report() in a human readable form.
+	 */
+	static void print(std::ostream& os);
+
+	/**
+	 * Discards all samples and forgets threads that have finished.
+	 */
+	static void reset();
+};
+
+class Logger;
+
+namespace detail {
+	/**
+	 * Times a log entry if it is sampled. Samples do not nest, the
+	 * outermost sample on a thread accounts for the whole entry.
+	 */
+	class OverheadSample {
+		Logger const* logger;
+		bool sampled;
+		std::chrono::nanoseconds start;
+
+		OverheadSample(OverheadSample const&) = delete;
+		OverheadSample& operator=(OverheadSample const&) = delete;
+	public:
+		explicit OverheadSample(Logger const* logger);
+		OverheadSample(OverheadSample&& other) :
+			logger(other.logger), sampled(other.sampled), start(other.start)
+		{
+			other.logger = nullptr;
+		}
+		~OverheadSample();
+	};
+}
+
+}
+
+/// Samples the logging overhead of the enclosing scope.
+#define __L3PP_ACCOUNT(logger) ::l3pp::detail::OverheadSample L3PP_sample(logger)
+
+#else
+
+/// Accounting is disabled.
+#define __L3PP_ACCOUNT(logger) do { } while(false)
+
+#endif
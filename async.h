@@ -0,0 +1,279 @@
+/**
+ * @file async.h
+ *
+ * Defines the AsyncSink class, which moves formatting and writing of entries
+ * off the logging threads.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace l3pp {
+
+/**
+ * Returns a file descriptor that becomes readable when AsyncSinks without
+ * workers have pending entries, for use with `poll`, `epoll` or similar
+ * event loops. Only available on Linux, returns -1 elsewhere.
+ */
+int getPendingFd();
+
+/**
+ * Formats and writes pending entries of AsyncSinks without workers on the
+ * calling thread, e.g. in each iteration of an event loop. Stops after
+ * roughly the given time or number of formatted bytes, whichever is reached
+ * first. Each sink writes at least one batch if it has entries pending, such
+ * that all sinks make progress.
+ * @return Whether entries are still pending. In that case, the descriptor
+ *   of getPendingFd() stays readable.
+ */
+bool processPending(std::chrono::steady_clock::duration time,
+		std::size_t bytes = static_cast<std::size_t>(-1));
+
+/**
+ * Sink that passes entries to another sink asynchronously. Logging only
+ * copies the entry into a bounded queue. A pool of worker threads takes
+ * batches of queued entries and formats them with the formatter of the
+ * target sink, such that expensive formatters scale with the number of
+ * workers. Formatted entries are written to the target sink (see
+ * Sink::write()) in the order in which they were logged, by whichever worker
+ * completes the oldest pending batch.
+ * The formatter of the target sink must be safe to call concurrently, which
+ * holds for the formatters of this library. Entries that are still queued
+ * are written when the AsyncSink is destroyed.
+ *
+ * Optionally, each logging thread collects its entries in a batch of its own
+ * and queues the whole batch at once, see setProducerBatching(). This saves
+ * synchronization when threads log many entries in bulk. Entries of one
+ * thread are still written in order, but entries of different threads are
+ * interleaved batch-wise.
+ *
+ * The memory held by queued entries counts against the MemoryBudget.
+ *
+ * An AsyncSink created without workers is driven by an event loop instead,
+ * see processPending(). Logging threads then only wake up the loop through
+ * getPendingFd(), and only write entries themselves when the queue is full,
+ * the MemoryBudget is exhausted, or on flush().
+ *
+ * Logging to an AsyncSink is not realtime-safe: queueing an entry, or a
+ * batch, locks the mutex of the sink and allocates, and without workers it
+ * also writes to the descriptor of getPendingFd().
+ */
+class AsyncSink: public Sink {
+public:
+	enum : std::size_t {
+		/// Maximum number of entries a worker formats at once.
+		BatchSize = 64,
+		/// Bytes a logging thread reserves from the MemoryBudget at once for
+		/// its batch.
+		CreditSize = 16384
+	};
+
+private:
+	struct Record {
+		EntryContext context;
+		/// Keeps the logger of the entry, or the loggers of its batch, alive
+		/// until it is written.
+		std::shared_ptr<void const> keepAlive;
+		std::string message;
+		std::string formatted;
+		bool done;
+	};
+
+	/// Loggers of the entries of a batch.
+	typedef std::vector<std::shared_ptr<Logger const>> LoggerPins;
+
+	/**
+	 * Entries of a single logging thread that were not queued yet. Only the
+	 * logging thread appends to it, without locking: it fills the slots and
+	 * then publishes their number in count. The slots from taken to count are
+	 * claimed and queued under the mutex of the sink, by the logging thread
+	 * or by others, and the logging thread starts over once all are queued.
+	 *
+	 * The loggers of unclaimed entries are kept alive by pins, and their
+	 * memory is taken from credit reserved in steps. A claim gives back the
+	 * remaining credit, hands pins over to its last entry and increments
+	 * epoch, after which the logging thread pins its loggers again. It checks
+	 * epoch after publishing an entry, and the claims check count after
+	 * incrementing epoch, so an entry whose logger was pinned in a set that
+	 * was handed over already is detected by one side or the other.
+	 */
+	struct ProducerBatch {
+		std::vector<Record> slots;
+		std::atomic<std::size_t> count;
+		std::atomic<std::uint64_t> epoch;
+		/// Guarded by the mutex of the sink.
+		std::size_t taken;
+		std::shared_ptr<LoggerPins> pins;
+		/// Pins of the last claim, which holds the latest entries.
+		std::weak_ptr<LoggerPins> handedOver;
+		/// Time of the first entry, published with count.
+		std::chrono::steady_clock::time_point started;
+		/// Remaining fields are only used by the logging thread.
+		std::vector<Logger const*> pinned;
+		std::uint64_t pinnedEpoch;
+		std::size_t bytes;
+		/// Memory reserved and not taken by entries yet. The logging thread
+		/// takes from it and adds to it, claims take all of it.
+		std::atomic<std::size_t> credit;
+
+		explicit ProducerBatch(std::size_t size) :
+			slots(size, Record{EntryContext(nullptr, 0, nullptr), nullptr, std::string(), std::string(), false}),
+			count(0), epoch(0), taken(0), pinnedEpoch(0), bytes(0), credit(0) {
+		}
+
+		~ProducerBatch();
+	};
+
+	/**
+	 * References that keep loggers of written entries alive. Released only
+	 * once no lock is held, as the last reference to a logger may destroy
+	 * this sink.
+	 */
+	typedef std::vector<std::shared_ptr<void const>> LoggerRefs;
+
+	/// Target sink.
+	SinkPtr sink;
+	/// Maximum number of queued entries.
+	std::size_t capacity;
+
+	mutable std::mutex mutex;
+	/// Signalled when entries are queued or the sink is destroyed.
+	mutable std::condition_variable queued;
+	/// Signalled when entries are written.
+	mutable std::condition_variable written;
+	/// Entries that have not been written yet, oldest first.
+	mutable std::deque<Record> records;
+	/// Number of entries at the front of records claimed by a worker.
+	mutable std::size_t claimed;
+	/// Whether a worker is writing entries to the target sink.
+	mutable bool writing;
+	bool stopping;
+	std::vector<std::thread> workers;
+	/// Cleared when the sink is destroyed by one of its workers.
+	std::shared_ptr<std::atomic<bool>> alive;
+
+	/// Identifies the sink in the batches of the logging threads.
+	std::uint64_t id;
+	/// Batching thresholds, see setProducerBatching().
+	std::size_t batchRecords;
+	std::size_t batchBytes;
+	/// Also guarded by mutex, as it is read by the workers.
+	std::chrono::steady_clock::duration batchDelay;
+	/// Batches of all threads that logged to this sink.
+	mutable std::vector<std::shared_ptr<ProducerBatch>> producers;
+	/// Time when batches were last checked for the time bound.
+	mutable std::chrono::steady_clock::time_point lastSweep;
+
+	AsyncSink(SinkPtr sink, unsigned workers, std::size_t capacity);
+
+	Record makeRecord(EntryContext const& context, std::string const& message) const;
+	/// Bytes charged to the MemoryBudget for a record.
+	static std::size_t getCost(Record const& record) {
+		return sizeof(Record) + record.message.size();
+	}
+	bool reserveMemory(std::size_t bytes, LogLevel level, bool wait, std::unique_lock<std::mutex>& lock,
+			LoggerRefs& released) const;
+	bool enqueue(EntryContext const& context, std::string const& message, bool wait) const;
+	bool enqueueBatched(ProducerBatch& batch, EntryContext const& context, std::string const& message,
+			bool wait) const;
+	/// Takes the memory for an entry of the given cost from the credit of the
+	/// batch, reserving more if needed.
+	bool reserveCredit(ProducerBatch& batch, std::size_t cost) const;
+	/// Keeps the logger of the entry in the given slot alive.
+	void resync(ProducerBatch& batch, Logger const* logger, std::size_t slot) const;
+	bool publish(ProducerBatch& batch, bool wait) const;
+	/// Queues the unclaimed entries of the batch, and gives back its credit.
+	void claim(ProducerBatch& batch) const;
+	void publishBatches(bool all, LoggerRefs& released) const;
+	/// Returns the batch of the current thread, or nullptr if the
+	/// MemoryBudget has no room for a new one.
+	ProducerBatch* getProducerBatch() const;
+	void work();
+	/// Formats and writes a batch of queued entries, returns the formatted bytes.
+	std::size_t formatBatch(std::unique_lock<std::mutex>& lock, LoggerRefs& released) const;
+	/// Waits until entries are written, writing them itself without workers.
+	void waitForSpace(std::unique_lock<std::mutex>& lock, LoggerRefs& released) const;
+	bool isWorker() const;
+	void notifyQueued(bool first) const;
+	std::size_t process(std::chrono::steady_clock::time_point deadline, std::size_t bytes, LoggerRefs& released) const;
+	bool isPending() const;
+	void writeCompleted(std::unique_lock<std::mutex>& lock, LoggerRefs& released) const;
+
+	friend bool processPending(std::chrono::steady_clock::duration time, std::size_t bytes);
+
+public:
+	~AsyncSink();
+
+	/**
+	 * Queues the entry, waiting for space if the queue is full.
+	 */
+	void log(EntryContext const& context, std::string const& message) const override;
+
+	/**
+	 * Queues the entry, or drops it if the queue is full or currently
+	 * locked by another thread.
+	 */
+	bool tryLog(EntryContext const& context, std::string const& message) const override;
+
+	/**
+	 * Waits until all entries logged so far, including those in batches of
+	 * logging threads, are written to the target sink.
+	 */
+	void flush() const override;
+
+	/**
+	 * Enables batching of entries on the logging threads. A thread queues
+	 * its batch once it holds the given number of entries or message bytes,
+	 * when an entry of level ERR or higher is logged, or on flush(). Batches
+	 * older than the given delay are queued by the workers, or without
+	 * workers by processPending(), so an event loop should call it at least
+	 * that often, e.g. by using the delay as its poll timeout. Batches are
+	 * queued as a whole and may exceed the capacity of the queue.
+	 * Each thread allocates room for the given number of entries per sink,
+	 * which is freed when it exits, or when it next logs to a sink it has
+	 * not used yet after the sink was destroyed. This room is charged to the
+	 * MemoryBudget, and a thread that finds no room for it queues its
+	 * entries one by one instead. Entries take their memory from credit that
+	 * the thread reserves in steps of CreditSize, and the credit left is
+	 * given back whenever the batch is queued. So the memory of batches
+	 * grows with the number of logging threads, but within the budget.
+	 * A record limit of at most one disables batching (the default), a byte
+	 * limit or delay of zero disables that bound.
+	 * Must be called before the sink is used.
+	 */
+	void setProducerBatching(std::size_t records, std::size_t bytes, std::chrono::steady_clock::duration delay) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			batchRecords = records;
+			batchBytes = bytes;
+			batchDelay = delay;
+		}
+		// Idle workers start checking the time bound
+		queued.notify_all();
+	}
+
+	SinkPtr getSink() const {
+		return sink;
+	}
+
+	/**
+	 * Create an AsyncSink.
+	 * @param sink Target sink, which entries are formatted for and written to.
+	 * @param workers Number of worker threads, or 0 to write entries in
+	 *   processPending().
+	 * @param capacity Maximum number of queued entries.
+	 */
+	static std::shared_ptr<AsyncSink> create(SinkPtr sink, unsigned workers = 1, std::size_t capacity = 8192) {
+		return std::shared_ptr<AsyncSink>(new AsyncSink(sink, workers, capacity));
+	}
+};
+
+}
@@ -0,0 +1,64 @@
+/**
+ * @file budget.h
+ *
+ * Defines the MemoryBudget class, which bounds the memory held by queued
+ * log entries.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace l3pp {
+
+/**
+ * Global bound on the memory held by entries that were logged but not yet
+ * written, i.e. entries in the queues of all AsyncSinks and in the batches
+ * of logging threads, entries held back by RequestScopes, and output in the
+ * buffers of RoutingFileSinks. An entry is charged with its message size plus a
+ * fixed overhead from the moment it is queued until it is written.
+ *
+ * Once the budget is exhausted, logging threads queue their batches
+ * immediately instead of filling them up, RoutingFileSinks write entries
+ * without buffering them, entries below the drop level are
+ * dropped, and other entries wait while their AsyncSink writes its queue
+ * (or are dropped by tryLog()). Entries that still find no memory once the
+ * queue is empty are dropped, as the memory is then held elsewhere and may
+ * not be freed. By default, the budget is unlimited.
+ */
+class MemoryBudget {
+public:
+	/**
+	 * Sets the budget in bytes, or 0 for no limit.
+	 */
+	static void setLimit(std::size_t bytes);
+
+	static std::size_t getLimit();
+
+	/**
+	 * Sets the level below which entries are dropped while the budget is
+	 * exhausted. By default, entries below WARN are dropped.
+	 */
+	static void setDropLevel(LogLevel level);
+
+	static LogLevel getDropLevel();
+
+	/**
+	 * Returns the number of bytes currently charged.
+	 */
+	static std::size_t getUsage();
+
+	/**
+	 * Returns the highest number of bytes charged at any time.
+	 */
+	static std::size_t getPeakUsage();
+
+	/**
+	 * Returns the number of entries dropped because the budget was
+	 * exhausted.
+	 */
+	static std::uint64_t getDropped();
+};
+
+}
@@ -0,0 +1,67 @@
+/**
+ * @file encoding.h
+ *
+ * Defines manipulators to log binary data as hex or base64 strings.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+
+namespace l3pp {
+
+/**
+ * Binary data to be streamed in some encoding. Instances are created by
+ * hex() and base64() and should only be used as temporaries, as they do not
+ * copy the data.
+ */
+template<typename Encoding>
+class EncodedBytes {
+	unsigned char const* data;
+	std::size_t length;
+	std::size_t maxBytes;
+
+public:
+	EncodedBytes(void const* data, std::size_t length, std::size_t maxBytes) :
+		data(static_cast<unsigned char const*>(data)), length(length),
+		maxBytes(maxBytes)
+	{
+	}
+
+	template<typename E>
+	friend std::ostream& operator<<(std::ostream& os, EncodedBytes<E> const& bytes);
+};
+
+namespace detail {
+	/// Lowercase hex encoding, two characters per byte.
+	struct HexEncoding;
+	/// Standard base64 encoding with padding.
+	struct Base64Encoding;
+}
+
+/**
+ * Streams binary data as lowercase hex string, e.g.
+ * @code{.cpp}
+ * L3PP_LOG_DEBUG("net", "header: " << l3pp::hex(packet, size, 64));
+ * @endcode
+ * The data is encoded in blocks (vectorized if SSE2 is available) rather
+ * than byte by byte.
+ * @param data Pointer to the data.
+ * @param length Number of bytes.
+ * @param maxBytes Maximum number of bytes to print. If the data is longer,
+ * it is truncated and "...(+N bytes)" is appended.
+ */
+inline EncodedBytes<detail::HexEncoding> hex(void const* data, std::size_t length, std::size_t maxBytes = static_cast<std::size_t>(-1)) {
+	return EncodedBytes<detail::HexEncoding>(data, length, maxBytes);
+}
+
+/**
+ * Streams binary data as base64 string, see hex(). The encoding is
+ * vectorized if SSSE3 is available.
+ */
+inline EncodedBytes<detail::Base64Encoding> base64(void const* data, std::size_t length, std::size_t maxBytes = static_cast<std::size_t>(-1)) {
+	return EncodedBytes<detail::Base64Encoding>(data, length, maxBytes);
+}
+
+}
@@ -7,11 +7,26 @@
 
 #pragma once
 
+#include <sstream>
 #include <string>
 #include <tuple>
 
 namespace l3pp {
 
+/**
+ * Controls how formatters handle messages that span multiple lines.
+ */
+enum class MultiLine {
+	/// Continuation lines are printed as they are.
+	PLAIN,
+	/// Every continuation line is preceded by the output that precedes the
+	/// message on the first line.
+	PREFIX,
+	/// Every continuation line is indented to where the message starts on
+	/// the first line.
+	INDENT
+};
+
 /**
  * Formats a log messages. This is a base class that simply print the message
  * with the log level prefix, see derived classes such as TemplatedFormatter
@@ -20,18 +35,77 @@ namespace l3pp {
 class Formatter {
 	friend class Logger;
 
+	MultiLine multiLine;
+
 	static void initialize();
 
 	virtual std::string format(EntryContext const& context, std::string const& msg) const;
+protected:
+	/**
+	 * Applies the multi-line mode to a message, given the output that
+	 * precedes the message on its first line.
+	 * @param buffer Storage for the result, if the message is changed.
+	 * @return Either msg or buffer.
+	 */
+	std::string const& formatLines(std::string const& prefix, std::string const& msg, std::string& buffer) const;
 public:
+	Formatter() : multiLine(MultiLine::PLAIN) {
+	}
+
 	virtual ~Formatter() {}
 
+	MultiLine getMultiLine() const {
+		return multiLine;
+	}
+
+	/**
+	 * Sets how messages spanning multiple lines are formatted. By default,
+	 * continuation lines are printed as they are.
+	 */
+	void setMultiLine(MultiLine multiLine) {
+		this->multiLine = multiLine;
+	}
+
 	std::string operator()(EntryContext const& context, std::string const& msg) {
 		return format(context, msg);
 	}
 };
 typedef std::shared_ptr<Formatter> FormatterPtr;
 
+/**
+ * Formatter that makes messages safe for line-oriented log consumers before
+ * passing them on to another formatter. Control characters other than tab
+ * are escaped (e.g. "\\n", "\\x1b"), as are bytes that are not part of
+ * valid UTF-8 and UTF-8 encoded C1 control characters. Backslashes are
+ * doubled, so escapes cannot be forged and can be reversed. Messages that
+ * need no escaping, including valid UTF-8, are passed on without copying;
+ * runs of printable ASCII are detected with a vectorized scan (if SSE2 is
+ * available).
+ */
+class SanitizingFormatter : public Formatter {
+	FormatterPtr formatter;
+
+	std::string format(EntryContext const& context, std::string const& msg) const override;
+public:
+	explicit SanitizingFormatter(FormatterPtr formatter) : formatter(formatter) {
+	}
+
+	/**
+	 * Escapes the given string as described above.
+	 */
+	static std::string sanitize(std::string const& msg);
+};
+
+/**
+ * Helper function to create a SanitizingFormatter, e.g.
+ * @code{.cpp}
+ * sink->setFormatter(l3pp::makeSanitizingFormatter(sink->getFormatter()));
+ * @endcode
+ */
+inline FormatterPtr makeSanitizingFormatter(FormatterPtr formatter) {
+	return std::make_shared<SanitizingFormatter>(formatter);
+}
+
 /**
  * Possible fields for FieldStr instance
  */
@@ -52,6 +126,8 @@ enum class Field {
 	LogLevel,
 	/// Number of milliseconds since the logger was initialized
 	WallTime,
+	/// Stack trace, one frame per line, if captured
+	StackTrace,
 };
 
 /**
@@ -109,14 +185,14 @@ class TemplateFormatter : public Formatter {
 
 	template <int N>
 	typename std::enable_if<N < (sizeof...(Formatters))>::type
-	formatTuple(EntryContext const& context, std::string const& msg, std::ostream& os) const {
+	formatTuple(EntryContext const& context, std::string const& msg, std::stringstream& os) const {
 		formatElement(std::get<N>(formatters), os, context, msg);
 		formatTuple<N+1>(context, msg, os);
 	}
 
 	template <int N>
 	typename std::enable_if<(N >= sizeof...(Formatters))>::type
-	formatTuple(EntryContext const&, std::string const&, std::ostream&) const {
+	formatTuple(EntryContext const&, std::string const&, std::stringstream&) const {
 	}
 
 	template<Field field, int Width, Justification j, char Fill>
@@ -124,6 +200,16 @@ class TemplateFormatter : public Formatter {
 		t.stream(stream, context, msg);
 	}
 
+	template<int Width, Justification j, char Fill>
+	void formatElement(FieldStr<Field::Message, Width, j, Fill> const& t, std::stringstream& stream, EntryContext const& context, std::string const& msg) const {
+		if (getMultiLine() == MultiLine::PLAIN) {
+			t.stream(stream, context, msg);
+		} else {
+			std::string buffer;
+			t.stream(stream, context, formatLines(stream.str(), msg, buffer));
+		}
+	}
+
 	void formatElement(TimeStr const& t, std::ostream& stream, EntryContext const& context, std::string const& msg) const {
 		t.stream(stream, context, msg);
 	}
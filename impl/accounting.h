@@ -0,0 +1,257 @@
+/**
+ * @file accounting.h
+ *
+ * Implementation of the logging overhead accounting
+ */
+
+#pragma once
+
+#ifdef L3PP_ENABLE_ACCOUNTING
+
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+#if defined(_POSIX_THREAD_CPUTIME) && _POSIX_THREAD_CPUTIME >= 0
+#include <pthread.h>
+#include <time.h>
+#define L3PP_HAVE_THREAD_CPUTIME
+#endif
+
+namespace l3pp {
+
+namespace detail {
+	/**
+	 * CPU time used by the current thread. Falls back to wall time if the
+	 * platform does not provide per-thread CPU clocks, such that preemption
+	 * is not accounted for.
+	 */
+	inline std::chrono::nanoseconds GetThreadCpuTime() {
+#ifdef L3PP_HAVE_THREAD_CPUTIME
+		timespec ts;
+		if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+			return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+		}
+#endif
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch());
+	}
+
+	/**
+	 * Accounting data of a single thread. Samples are added by the thread
+	 * itself, and read by Accounting::report().
+	 */
+	struct AccountingThread {
+		std::thread::id thread;
+#ifdef L3PP_HAVE_THREAD_CPUTIME
+		clockid_t clock;
+#endif
+		/// CPU time of the thread when accounting started.
+		std::chrono::nanoseconds baseline;
+		/// CPU time of the thread when it finished.
+		std::chrono::nanoseconds finished;
+		bool running;
+		std::map<std::string, std::chrono::nanoseconds> loggers;
+		std::mutex mutex;
+
+		AccountingThread() : thread(std::this_thread::get_id()),
+			baseline(0), finished(0), running(true)
+		{
+#ifdef L3PP_HAVE_THREAD_CPUTIME
+			if (pthread_getcpuclockid(pthread_self(), &clock) != 0) {
+				clock = CLOCK_MONOTONIC;
+			}
+#endif
+			baseline = cpuTime();
+		}
+
+		/**
+		 * CPU time used by the thread. Falls back to wall time if the
+		 * platform does not provide per-thread CPU clocks. Must be called
+		 * with the mutex held, unless called by the thread itself.
+		 */
+		std::chrono::nanoseconds cpuTime() const {
+			if (!running) {
+				return finished;
+			}
+#ifdef L3PP_HAVE_THREAD_CPUTIME
+			timespec ts;
+			if (clock_gettime(clock, &ts) == 0) {
+				return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+			}
+#endif
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch());
+		}
+	};
+
+	/**
+	 * Internal function to get all threads known to the accounting.
+	 */
+	static inline std::vector<std::shared_ptr<AccountingThread>>& GetAccountingThreads() {
+		static std::vector<std::shared_ptr<AccountingThread>> threads;
+		return threads;
+	}
+
+	static inline std::mutex& GetAccountingMutex() {
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	static inline std::atomic<unsigned>& GetSampleRate() {
+		static std::atomic<unsigned> rate(1024);
+		return rate;
+	}
+
+	/**
+	 * Per-thread sampling state. The thread registers itself with the
+	 * accounting on its first sample.
+	 */
+	struct AccountingState {
+		unsigned counter;
+		unsigned depth;
+		std::shared_ptr<AccountingThread> thread;
+
+		AccountingState() : counter(0), depth(0) {
+		}
+
+		~AccountingState() {
+			if (thread) {
+				std::lock_guard<std::mutex> lock(thread->mutex);
+				thread->finished = thread->cpuTime();
+				thread->running = false;
+			}
+		}
+
+		AccountingThread& get() {
+			if (!thread) {
+				thread = std::make_shared<AccountingThread>();
+				std::lock_guard<std::mutex> lock(GetAccountingMutex());
+				GetAccountingThreads().push_back(thread);
+			}
+			return *thread;
+		}
+	};
+
+	static inline AccountingState& GetAccountingState() {
+		static thread_local AccountingState state;
+		return state;
+	}
+
+	inline OverheadSample::OverheadSample(Logger const* logger) :
+		logger(logger), sampled(false)
+	{
+		if (!logger) {
+			return;
+		}
+		AccountingState& state = GetAccountingState();
+		if (state.depth++ > 0 || ++state.counter < GetSampleRate().load(std::memory_order_relaxed)) {
+			return;
+		}
+		state.counter = 0;
+		sampled = true;
+		start = GetThreadCpuTime();
+	}
+
+	inline OverheadSample::~OverheadSample() {
+		if (!logger) {
+			return;
+		}
+		AccountingState& state = GetAccountingState();
+		--state.depth;
+		if (!sampled) {
+			return;
+		}
+		auto elapsed = GetThreadCpuTime() - start;
+		AccountingThread& thread = state.get();
+		std::lock_guard<std::mutex> lock(thread.mutex);
+		thread.loggers[logger->getName()] += elapsed * GetSampleRate().load(std::memory_order_relaxed);
+	}
+}
+
+inline std::chrono::nanoseconds ThreadOverhead::logTime() const {
+	std::chrono::nanoseconds total(0);
+	for (auto const& logger: loggers) {
+		total += logger.second;
+	}
+	return total;
+}
+
+inline double ThreadOverhead::percentage() const {
+	if (cpuTime.count() <= 0) {
+		return 0;
+	}
+	return 100.0 * logTime().count() / cpuTime.count();
+}
+
+inline double ThreadOverhead::percentage(std::string const& logger) const {
+	auto it = loggers.find(logger);
+	if (it == loggers.end() || cpuTime.count() <= 0) {
+		return 0;
+	}
+	return 100.0 * it->second.count() / cpuTime.count();
+}
+
+inline void Accounting::setSampleRate(unsigned rate) {
+	detail::GetSampleRate() = rate > 0 ? rate : 1;
+}
+
+inline unsigned Accounting::getSampleRate() {
+	return detail::GetSampleRate();
+}
+
+inline std::vector<ThreadOverhead> Accounting::report() {
+	std::vector<ThreadOverhead> result;
+	std::lock_guard<std::mutex> lock(detail::GetAccountingMutex());
+	for (auto const& thread: detail::GetAccountingThreads()) {
+		std::lock_guard<std::mutex> threadLock(thread->mutex);
+		ThreadOverhead overhead;
+		overhead.thread = thread->thread;
+		overhead.running = thread->running;
+		overhead.cpuTime = thread->cpuTime() - thread->baseline;
+		overhead.loggers = thread->loggers;
+		result.push_back(overhead);
+	}
+	return result;
+}
+
+inline void Accounting::print(std::ostream& os) {
+	for (auto const& overhead: report()) {
+		os << "thread " << overhead.thread << ": " << std::fixed << std::setprecision(2)
+			<< overhead.percentage() << "% of "
+			<< std::chrono::duration_cast<std::chrono::milliseconds>(overhead.cpuTime).count()
+			<< "ms CPU time" << (overhead.running ? "" : " (finished)") << '\n';
+		for (auto const& logger: overhead.loggers) {
+			os << "  " << (logger.first.empty() ? "<root>" : logger.first) << ": "
+				<< overhead.percentage(logger.first) << "%\n";
+		}
+	}
+}
+
+inline void Accounting::reset() {
+	std::lock_guard<std::mutex> lock(detail::GetAccountingMutex());
+	auto& threads = detail::GetAccountingThreads();
+	auto it = threads.begin();
+	while (it != threads.end()) {
+		bool running;
+		{
+			std::lock_guard<std::mutex> threadLock((*it)->mutex);
+			running = (*it)->running;
+			(*it)->baseline = (*it)->cpuTime();
+			(*it)->loggers.clear();
+		}
+		if (running) {
+			++it;
+		} else {
+			it = threads.erase(it);
+		}
+	}
+}
+
+}
+
+#endif
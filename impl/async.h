@@ -0,0 +1,596 @@
+/**
+ * @file async.h
+ *
+ * Implementation of the AsyncSink class
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace l3pp {
+
+namespace detail {
+	/**
+	 * Internal function to get a unique id for an AsyncSink.
+	 */
+	inline std::uint64_t NextAsyncSinkId() {
+		static std::atomic<std::uint64_t> next(0);
+		return ++next;
+	}
+
+	/**
+	 * Internal function to get the AsyncSinks without workers, which are
+	 * processed by processPending(). The mutex is held while processing.
+	 */
+	inline std::vector<AsyncSink const*>& GetEventSinks() {
+		static std::vector<AsyncSink const*> sinks;
+		return sinks;
+	}
+
+	inline std::mutex& GetEventSinksMutex() {
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	/**
+	 * Internal function to signal that AsyncSinks without workers have
+	 * pending entries, see getPendingFd().
+	 */
+	inline void SignalPending() {
+#if defined(__linux__)
+		int fd = getPendingFd();
+		if (fd >= 0) {
+			std::uint64_t one = 1;
+			ssize_t result = ::write(fd, &one, sizeof(one));
+			(void)result;
+		}
+#endif
+	}
+}
+
+inline int getPendingFd() {
+#if defined(__linux__)
+	static int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return fd;
+#else
+	return -1;
+#endif
+}
+
+inline bool processPending(std::chrono::steady_clock::duration time, std::size_t bytes) {
+#if defined(__linux__)
+	int fd = getPendingFd();
+	if (fd >= 0) {
+		std::uint64_t count;
+		ssize_t result = ::read(fd, &count, sizeof(count));
+		(void)result;
+	}
+#endif
+	auto deadline = std::chrono::steady_clock::now() + time;
+	bool pending = false;
+	// Destroying a logger may destroy a sink, which locks the registry
+	AsyncSink::LoggerRefs released;
+	{
+		std::lock_guard<std::mutex> lock(detail::GetEventSinksMutex());
+		for (auto sink: detail::GetEventSinks()) {
+			std::size_t written = sink->process(deadline, bytes, released);
+			bytes -= std::min(written, bytes);
+			pending = sink->isPending() || pending;
+		}
+	}
+	if (pending) {
+		// Keep the descriptor readable for the next iteration of the loop
+		detail::SignalPending();
+	}
+	return pending;
+}
+
+inline AsyncSink::AsyncSink(SinkPtr sink, unsigned workers, std::size_t capacity) :
+		sink(sink), capacity(std::max<std::size_t>(capacity, 1)),
+		claimed(0), writing(false), stopping(false),
+		alive(std::make_shared<std::atomic<bool>>(true)),
+		id(detail::NextAsyncSinkId()), batchRecords(1), batchBytes(0),
+		batchDelay(std::chrono::steady_clock::duration::zero()),
+		lastSweep(std::chrono::steady_clock::now())
+{
+	if (workers == 0) {
+		std::lock_guard<std::mutex> lock(detail::GetEventSinksMutex());
+		detail::GetEventSinks().push_back(this);
+	}
+	for (unsigned i = 0; i < workers; ++i) {
+		this->workers.emplace_back(&AsyncSink::work, this);
+	}
+}
+
+inline AsyncSink::~AsyncSink() {
+	if (workers.empty()) {
+		std::lock_guard<std::mutex> lock(detail::GetEventSinksMutex());
+		auto& sinks = detail::GetEventSinks();
+		sinks.erase(std::remove(sinks.begin(), sinks.end(), this), sinks.end());
+	}
+	// If a worker released the last reference, it writes the remaining
+	// entries itself and leaves its loop once this returns
+	flush();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	*alive = false;
+	queued.notify_all();
+	for (auto& worker: workers) {
+		if (worker.get_id() == std::this_thread::get_id()) {
+			worker.detach();
+		} else {
+			worker.join();
+		}
+	}
+}
+
+inline AsyncSink::ProducerBatch::~ProducerBatch() {
+	// The slots, unused credit, and entries that were never queued
+	std::size_t cost = slots.size() * sizeof(Record) + credit;
+	for (std::size_t i = taken; i < count; ++i) {
+		cost += sizeof(Record) + slots[i].message.size();
+	}
+	detail::ReleaseMemory(cost);
+}
+
+inline AsyncSink::Record AsyncSink::makeRecord(EntryContext const& context, std::string const& message) const {
+	std::shared_ptr<void const> logger;
+	if (context.logger) {
+		logger = context.logger->shared_from_this();
+	}
+	return Record{context, std::move(logger), message, std::string(), false};
+}
+
+inline bool AsyncSink::enqueue(EntryContext const& context, std::string const& message, bool wait) const {
+	if (batchRecords > 1) {
+		// Without memory for a batch of its own, the thread uses the queue
+		ProducerBatch* batch = getProducerBatch();
+		if (batch) {
+			if (reserveCredit(*batch, sizeof(Record) + message.size())) {
+				return enqueueBatched(*batch, context, message, wait);
+			}
+			// Stop holding entries back, and wait for memory for this one
+			publish(*batch, wait);
+		}
+	}
+	Record record = makeRecord(context, message);
+	std::size_t cost = getCost(record);
+	LoggerRefs released;
+	std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+	if (wait) {
+		lock.lock();
+	} else if (!lock.try_lock()) {
+		return false;
+	}
+	if (!reserveMemory(cost, context.level, wait, lock, released)) {
+		return false;
+	}
+	if (records.size() >= capacity && !wait) {
+		detail::ReleaseMemory(cost);
+		return false;
+	}
+	while (records.size() >= capacity) {
+		waitForSpace(lock, released);
+	}
+	L3PP_PROBE(enqueue, detail::GetLoggerName(context.logger), context.level, message.size());
+	records.push_back(std::move(record));
+	bool first = records.size() == 1;
+	lock.unlock();
+	notifyQueued(first);
+	return true;
+}
+
+inline AsyncSink::ProducerBatch* AsyncSink::getProducerBatch() const {
+	static thread_local std::unordered_map<std::uint64_t, std::shared_ptr<ProducerBatch>> batches;
+	// Threads mostly log to the same sink, and ids are never reused
+	static thread_local std::pair<std::uint64_t, ProducerBatch*> last(0, nullptr);
+	if (last.first == id) {
+		return last.second;
+	}
+	auto found = batches.find(id);
+	if (found == batches.end()) {
+		// Only this thread is left to refer to batches of destroyed sinks
+		for (auto batch = batches.begin(); batch != batches.end();) {
+			if (batch->second.use_count() == 1) {
+				batch = batches.erase(batch);
+			} else {
+				++batch;
+			}
+		}
+		if (!detail::ReserveMemory(batchRecords * sizeof(Record))) {
+			return nullptr;
+		}
+		auto batch = std::make_shared<ProducerBatch>(batchRecords);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			producers.push_back(batch);
+		}
+		found = batches.emplace(id, std::move(batch)).first;
+	}
+	last = std::make_pair(id, found->second.get());
+	return last.second;
+}
+
+inline bool AsyncSink::reserveMemory(std::size_t bytes, LogLevel level, bool wait, std::unique_lock<std::mutex>& lock,
+		LoggerRefs& released) const {
+	while (!detail::ReserveMemory(bytes)) {
+		if (!wait || level < detail::GetMemoryDropLevel()) {
+			++detail::GetMemoryDropped();
+			return false;
+		}
+		// Queued batches of logging threads give back their credit
+		std::size_t queuedBefore = records.size();
+		for (auto const& batch: producers) {
+			if (batch->count.load(std::memory_order_acquire) > batch->taken) {
+				claim(*batch);
+			}
+		}
+		if (records.size() > queuedBefore) {
+			notifyQueued(queuedBefore == 0);
+			continue;
+		}
+		if (records.empty()) {
+			// Only memory held elsewhere is left, which may never be freed
+			++detail::GetMemoryDropped();
+			return false;
+		}
+		if (workers.empty()) {
+			// Write own entries, as nobody else does
+			if (claimed == records.size()) {
+				++detail::GetMemoryDropped();
+				return false;
+			}
+			formatBatch(lock, released);
+		} else {
+			// Memory released by other sinks is not signalled
+			written.wait_for(lock, std::chrono::milliseconds(1));
+		}
+	}
+	return true;
+}
+
+inline bool AsyncSink::reserveCredit(ProducerBatch& batch, std::size_t cost) const {
+	// Claims may take the credit at any time
+	std::size_t credit = batch.credit.load(std::memory_order_relaxed);
+	while (credit >= cost) {
+		if (batch.credit.compare_exchange_weak(credit, credit - cost, std::memory_order_relaxed)) {
+			return true;
+		}
+	}
+	std::size_t step = std::max<std::size_t>(CreditSize, cost);
+	if (!detail::ReserveMemory(step)) {
+		return false;
+	}
+	batch.credit.fetch_add(step - cost, std::memory_order_relaxed);
+	return true;
+}
+
+inline bool AsyncSink::enqueueBatched(ProducerBatch& batch, EntryContext const& context, std::string const& message,
+		bool wait) const {
+	if (batch.count.load(std::memory_order_relaxed) == batch.slots.size() && !publish(batch, wait)) {
+		return false;
+	}
+	std::size_t n = batch.count.load(std::memory_order_relaxed);
+	if (n == 0) {
+		batch.started = std::chrono::steady_clock::now();
+		batch.bytes = 0;
+	}
+	Logger const* logger = context.logger;
+	if (batch.epoch.load(std::memory_order_relaxed) != batch.pinnedEpoch) {
+		batch.pinned.clear();
+	}
+	if (logger && std::find(batch.pinned.begin(), batch.pinned.end(), logger) == batch.pinned.end()) {
+		resync(batch, logger, n);
+	}
+	Record& record = batch.slots[n];
+	record.context = context;
+	record.message = message;
+	batch.count.store(n + 1, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (batch.epoch.load(std::memory_order_relaxed) != batch.pinnedEpoch) {
+		// A claim may have handed over the pins without this entry
+		resync(batch, logger, n);
+	}
+	batch.bytes += message.size();
+	if (n + 1 == batch.slots.size() || (batchBytes > 0 && batch.bytes >= batchBytes) ||
+			context.level >= LogLevel::ERR) {
+		// Otherwise the entries stay in the batch for the next attempt
+		publish(batch, wait);
+	}
+	return true;
+}
+
+inline void AsyncSink::resync(ProducerBatch& batch, Logger const* logger, std::size_t slot) const {
+	// Released after the lock, as it may hold the last reference to a logger
+	std::shared_ptr<LoggerPins> pins;
+	std::lock_guard<std::mutex> lock(mutex);
+	if (logger) {
+		if (batch.taken > slot) {
+			// The entry was claimed by the last claim, unless all of its
+			// entries are written already
+			pins = batch.handedOver.lock();
+		} else {
+			if (!batch.pins) {
+				batch.pins = std::make_shared<LoggerPins>();
+			}
+			pins = batch.pins;
+		}
+		if (pins && std::none_of(pins->begin(), pins->end(), [logger](std::shared_ptr<Logger const> const& pin) {
+				return pin.get() == logger;
+			})) {
+			pins->push_back(logger->shared_from_this());
+		}
+	}
+	if (batch.epoch.load(std::memory_order_relaxed) != batch.pinnedEpoch) {
+		batch.pinned.clear();
+		batch.pinnedEpoch = batch.epoch.load(std::memory_order_relaxed);
+	}
+	if (logger && batch.taken <= slot) {
+		batch.pinned.push_back(logger);
+	}
+}
+
+inline bool AsyncSink::publish(ProducerBatch& batch, bool wait) const {
+	if (batch.count.load(std::memory_order_relaxed) == 0) {
+		return true;
+	}
+	LoggerRefs released;
+	std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+	if (wait) {
+		lock.lock();
+	} else if (!lock.try_lock()) {
+		return false;
+	}
+	if (records.size() >= capacity && !wait) {
+		return false;
+	}
+	while (records.size() >= capacity) {
+		waitForSpace(lock, released);
+	}
+	bool first = records.empty();
+	claim(batch);
+	// All entries are queued, start over
+	batch.count.store(0, std::memory_order_relaxed);
+	batch.taken = 0;
+	batch.pinned.clear();
+	batch.pinnedEpoch = batch.epoch.load(std::memory_order_relaxed);
+	lock.unlock();
+	notifyQueued(first);
+	return true;
+}
+
+inline void AsyncSink::claim(ProducerBatch& batch) const {
+	// Pairs with the fence of the logging thread after publishing an entry
+	batch.epoch.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	std::size_t end = batch.count.load(std::memory_order_acquire);
+	// Entries take their memory from the credit before they are published
+	detail::ReleaseMemory(batch.credit.exchange(0, std::memory_order_relaxed));
+	if (batch.taken == end) {
+		return;
+	}
+	for (std::size_t i = batch.taken; i < end; ++i) {
+		Record& record = batch.slots[i];
+		L3PP_PROBE(enqueue, detail::GetLoggerName(record.context.logger), record.context.level, record.message.size());
+		records.push_back(Record{record.context, nullptr, std::move(record.message), std::string(), false});
+	}
+	// Entries are written in order, so the last one keeps the others alive
+	batch.handedOver = batch.pins;
+	records.back().keepAlive = std::move(batch.pins);
+	batch.pins.reset();
+	batch.taken = end;
+}
+
+inline void AsyncSink::publishBatches(bool all, LoggerRefs& released) const {
+	std::unique_lock<std::mutex> lock(mutex);
+	std::size_t queuedBefore = records.size();
+	auto now = std::chrono::steady_clock::now();
+	for (auto& batch: producers) {
+		if (batch->count.load(std::memory_order_acquire) > batch->taken &&
+				(all || now - batch->started >= batchDelay)) {
+			claim(*batch);
+		}
+		// Only the registry is left if the thread exited
+		if (batch->taken == batch->count.load(std::memory_order_acquire) && batch.use_count() == 1) {
+			// Destroyed with the loggers of written entries
+			released.push_back(std::move(batch));
+		}
+	}
+	producers.erase(std::remove(producers.begin(), producers.end(), nullptr), producers.end());
+	bool published = records.size() > queuedBefore;
+	lock.unlock();
+	if (published) {
+		notifyQueued(queuedBefore == 0);
+	}
+}
+
+inline void AsyncSink::log(EntryContext const& context, std::string const& message) const {
+	enqueue(context, message, true);
+}
+
+inline bool AsyncSink::tryLog(EntryContext const& context, std::string const& message) const {
+	return enqueue(context, message, false);
+}
+
+inline void AsyncSink::flush() const {
+	LoggerRefs released;
+	publishBatches(true, released);
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!records.empty() || writing) {
+		waitForSpace(lock, released);
+	}
+}
+
+inline void AsyncSink::notifyQueued(bool first) const {
+	if (workers.empty()) {
+		if (first) {
+			detail::SignalPending();
+		}
+	} else {
+		queued.notify_all();
+	}
+}
+
+inline void AsyncSink::waitForSpace(std::unique_lock<std::mutex>& lock, LoggerRefs& released) const {
+	if ((workers.empty() || isWorker()) && claimed < records.size()) {
+		// Nobody else writes, unless processPending() runs concurrently, or
+		// this worker is destroying the sink
+		formatBatch(lock, released);
+	} else {
+		written.wait(lock);
+	}
+}
+
+inline bool AsyncSink::isWorker() const {
+	auto self = std::this_thread::get_id();
+	return std::any_of(workers.begin(), workers.end(), [self](std::thread const& worker) {
+		return worker.get_id() == self;
+	});
+}
+
+inline std::size_t AsyncSink::process(std::chrono::steady_clock::time_point deadline, std::size_t bytes,
+		LoggerRefs& released) const {
+	if (batchDelay > std::chrono::steady_clock::duration::zero()) {
+		publishBatches(false, released);
+	}
+	std::size_t processed = 0;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (claimed < records.size()) {
+		processed += formatBatch(lock, released);
+		if (processed >= bytes || std::chrono::steady_clock::now() >= deadline) {
+			break;
+		}
+	}
+	return processed;
+}
+
+inline bool AsyncSink::isPending() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return !records.empty();
+}
+
+inline std::size_t AsyncSink::formatBatch(std::unique_lock<std::mutex>& lock, LoggerRefs& released) const {
+	// Records keep their address while others are appended, and are only
+	// removed once they are done
+	std::size_t n = std::min<std::size_t>(BatchSize, records.size() - claimed);
+	Record* batch[BatchSize];
+	for (std::size_t i = 0; i < n; ++i) {
+		batch[i] = &records[claimed + i];
+	}
+	claimed += n;
+	lock.unlock();
+
+	std::size_t bytes = 0;
+	for (std::size_t i = 0; i < n; ++i) {
+		EntryContext const& context = batch[i]->context;
+		L3PP_PROBE(dequeue, detail::GetLoggerName(context.logger), context.level, batch[i]->message.size());
+		__L3PP_ACCOUNT(context.logger);
+		batch[i]->formatted = sink->formatMessage(context, batch[i]->message);
+		bytes += batch[i]->formatted.size();
+	}
+
+	lock.lock();
+	for (std::size_t i = 0; i < n; ++i) {
+		batch[i]->done = true;
+	}
+	writeCompleted(lock, released);
+	return bytes;
+}
+
+inline void AsyncSink::work() {
+	// Keeps the flag valid if releasing a logger destroys the sink
+	std::shared_ptr<std::atomic<bool>> alive = this->alive;
+	LoggerRefs released;
+	std::unique_lock<std::mutex> lock(mutex);
+	auto ready = [this]() { return stopping || claimed < records.size(); };
+	while (true) {
+		if (batchDelay > std::chrono::steady_clock::duration::zero()) {
+			// Queue batches of logging threads that exceed the time bound
+			auto now = std::chrono::steady_clock::now();
+			if (now - lastSweep >= batchDelay) {
+				lastSweep = now;
+				lock.unlock();
+				publishBatches(false, released);
+				released.clear();
+				if (!*alive) {
+					return;
+				}
+				lock.lock();
+			}
+			if (!queued.wait_for(lock, batchDelay, ready)) {
+				continue;
+			}
+		} else {
+			// Until entries are queued, or batching enables the time bound
+			queued.wait(lock, [this, &ready]() {
+				return ready() || batchDelay > std::chrono::steady_clock::duration::zero();
+			});
+			if (!ready()) {
+				continue;
+			}
+		}
+		if (claimed == records.size()) {
+			// Stopping, and all entries are claimed
+			return;
+		}
+		formatBatch(lock, released);
+		if (!released.empty()) {
+			lock.unlock();
+			released.clear();
+			if (!*alive) {
+				return;
+			}
+			lock.lock();
+		}
+	}
+}
+
+inline void AsyncSink::writeCompleted(std::unique_lock<std::mutex>& lock, LoggerRefs& released) const {
+	// A single worker writes at a time, the others leave their completed
+	// batches to it
+	if (writing) {
+		return;
+	}
+	writing = true;
+	std::vector<Record> batch;
+	while (!records.empty() && records.front().done) {
+		while (!records.empty() && records.front().done) {
+			batch.push_back(std::move(records.front()));
+			records.pop_front();
+			--claimed;
+		}
+		written.notify_all();
+		lock.unlock();
+
+		std::size_t cost = 0;
+		for (auto& record: batch) {
+			{
+				__L3PP_ACCOUNT(record.context.logger);
+				sink->write(record.context, record.message, record.formatted);
+			}
+			cost += getCost(record);
+			if (record.keepAlive) {
+				released.push_back(std::move(record.keepAlive));
+			}
+		}
+		sink->flush();
+		batch.clear();
+		detail::ReleaseMemory(cost);
+
+		lock.lock();
+	}
+	writing = false;
+	written.notify_all();
+}
+
+}
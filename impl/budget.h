@@ -0,0 +1,94 @@
+/**
+ * @file budget.h
+ *
+ * Implementation of the global memory budget
+ */
+
+#pragma once
+
+#include <atomic>
+
+namespace l3pp {
+
+namespace detail {
+	/**
+	 * Internal function to get the budget limit, 0 for no limit.
+	 */
+	inline std::atomic<std::size_t>& GetMemoryLimit() {
+		static std::atomic<std::size_t> limit(0);
+		return limit;
+	}
+
+	inline std::atomic<LogLevel>& GetMemoryDropLevel() {
+		static std::atomic<LogLevel> level(LogLevel::WARN);
+		return level;
+	}
+
+	inline std::atomic<std::size_t>& GetMemoryUsage() {
+		static std::atomic<std::size_t> usage(0);
+		return usage;
+	}
+
+	inline std::atomic<std::size_t>& GetMemoryPeak() {
+		static std::atomic<std::size_t> peak(0);
+		return peak;
+	}
+
+	inline std::atomic<std::uint64_t>& GetMemoryDropped() {
+		static std::atomic<std::uint64_t> dropped(0);
+		return dropped;
+	}
+
+	/**
+	 * Internal function to charge the given number of bytes to the budget.
+	 * @return False, without charging anything, if the budget would be
+	 *   exceeded.
+	 */
+	inline bool ReserveMemory(std::size_t bytes) {
+		std::size_t limit = GetMemoryLimit().load(std::memory_order_relaxed);
+		std::size_t usage = GetMemoryUsage().fetch_add(bytes, std::memory_order_relaxed) + bytes;
+		if (limit != 0 && usage > limit) {
+			GetMemoryUsage().fetch_sub(bytes, std::memory_order_relaxed);
+			return false;
+		}
+		auto& peak = GetMemoryPeak();
+		std::size_t previous = peak.load(std::memory_order_relaxed);
+		while (previous < usage && !peak.compare_exchange_weak(previous, usage, std::memory_order_relaxed)) {
+		}
+		return true;
+	}
+
+	inline void ReleaseMemory(std::size_t bytes) {
+		GetMemoryUsage().fetch_sub(bytes, std::memory_order_relaxed);
+	}
+}
+
+inline void MemoryBudget::setLimit(std::size_t bytes) {
+	detail::GetMemoryLimit() = bytes;
+}
+
+inline std::size_t MemoryBudget::getLimit() {
+	return detail::GetMemoryLimit();
+}
+
+inline void MemoryBudget::setDropLevel(LogLevel level) {
+	detail::GetMemoryDropLevel() = level;
+}
+
+inline LogLevel MemoryBudget::getDropLevel() {
+	return detail::GetMemoryDropLevel();
+}
+
+inline std::size_t MemoryBudget::getUsage() {
+	return detail::GetMemoryUsage();
+}
+
+inline std::size_t MemoryBudget::getPeakUsage() {
+	return detail::GetMemoryPeak();
+}
+
+inline std::uint64_t MemoryBudget::getDropped() {
+	return detail::GetMemoryDropped();
+}
+
+}
@@ -0,0 +1,156 @@
+/**
+ * @file container.h
+ *
+ * Implementation of streaming containers, pairs, tuples and optionals into
+ * a LogStream
+ */
+
+#pragma once
+
+#include <iterator>
+#include <ostream>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 201703L
+#include <optional>
+#endif
+
+namespace l3pp {
+
+namespace detail {
+	/**
+	 * Internal function to get the maximum number of printed container
+	 * elements. Should not be used directly, see Logger::getContainerLimit()
+	 */
+	static inline std::size_t& GetContainerLimit() {
+		static std::size_t limit = 32;
+		return limit;
+	}
+
+	/// Whether a type can be streamed to a std::ostream.
+	template<typename T, typename = void>
+	struct IsStreamable : std::false_type {};
+	template<typename T>
+	struct IsStreamable<T, decltype(void(std::declval<std::ostream&>() << std::declval<T const&>()))> : std::true_type {};
+
+	/// Whether a type can be iterated over.
+	template<typename T, typename = void>
+	struct IsRange : std::false_type {};
+	template<typename T>
+	struct IsRange<T, decltype(void(std::begin(std::declval<T const&>())), void(std::end(std::declval<T const&>())))> : std::true_type {};
+
+	/// Whether a range knows its size.
+	template<typename T, typename = void>
+	struct HasSize : std::false_type {};
+	template<typename T>
+	struct HasSize<T, decltype(void(std::declval<T const&>().size()))> : std::true_type {};
+
+	// All overloads are declared first, such that nested values find each other.
+	template<typename T>
+	typename std::enable_if<IsStreamable<T>::value>::type
+	StreamValue(std::ostream& os, T const& value);
+	template<typename T>
+	typename std::enable_if<!IsStreamable<T>::value && IsRange<T>::value>::type
+	StreamValue(std::ostream& os, T const& range);
+	template<typename T1, typename T2>
+	void StreamValue(std::ostream& os, std::pair<T1, T2> const& pair);
+	template<typename ... Ts>
+	void StreamValue(std::ostream& os, std::tuple<Ts...> const& tuple);
+#if __cplusplus >= 201703L
+	template<typename T>
+	void StreamValue(std::ostream& os, std::optional<T> const& optional);
+#endif
+
+	/**
+	 * Streams a value to a LogStream. Anything that can be streamed to a
+	 * std::ostream is streamed as is. Otherwise, ranges, pairs, tuples and
+	 * optionals are printed element-wise.
+	 */
+	template<typename T>
+	inline typename std::enable_if<IsStreamable<T>::value>::type
+	StreamValue(std::ostream& os, T const& value) {
+		os << value;
+	}
+
+	template<typename T>
+	inline typename std::enable_if<HasSize<T>::value>::type
+	StreamRemaining(std::ostream& os, T const& range, std::size_t printed) {
+		os << "...(+" << (range.size() - printed) << " more)";
+	}
+
+	template<typename T>
+	inline typename std::enable_if<!HasSize<T>::value>::type
+	StreamRemaining(std::ostream& os, T const&, std::size_t) {
+		os << "...(more)";
+	}
+
+	/**
+	 * Streams at most Logger::getContainerLimit() elements of a range, such
+	 * that the work does not depend on the size of the range.
+	 */
+	template<typename T>
+	inline typename std::enable_if<!IsStreamable<T>::value && IsRange<T>::value>::type
+	StreamValue(std::ostream& os, T const& range) {
+		std::size_t limit = GetContainerLimit();
+		std::size_t printed = 0;
+		os << '[';
+		auto end = std::end(range);
+		for (auto it = std::begin(range); it != end; ++it) {
+			if (printed > 0) {
+				os << ", ";
+			}
+			if (printed == limit) {
+				StreamRemaining(os, range, printed);
+				break;
+			}
+			StreamValue(os, *it);
+			++printed;
+		}
+		os << ']';
+	}
+
+	template<typename T1, typename T2>
+	inline void StreamValue(std::ostream& os, std::pair<T1, T2> const& pair) {
+		os << '(';
+		StreamValue(os, pair.first);
+		os << ", ";
+		StreamValue(os, pair.second);
+		os << ')';
+	}
+
+	template<std::size_t N, typename ... Ts>
+	inline typename std::enable_if<(N >= sizeof...(Ts))>::type
+	StreamTuple(std::ostream&, std::tuple<Ts...> const&) {
+	}
+
+	template<std::size_t N, typename ... Ts>
+	inline typename std::enable_if<(N < sizeof...(Ts))>::type
+	StreamTuple(std::ostream& os, std::tuple<Ts...> const& tuple) {
+		if (N > 0) {
+			os << ", ";
+		}
+		StreamValue(os, std::get<N>(tuple));
+		StreamTuple<N+1>(os, tuple);
+	}
+
+	template<typename ... Ts>
+	inline void StreamValue(std::ostream& os, std::tuple<Ts...> const& tuple) {
+		os << '(';
+		StreamTuple<0>(os, tuple);
+		os << ')';
+	}
+
+#if __cplusplus >= 201703L
+	template<typename T>
+	inline void StreamValue(std::ostream& os, std::optional<T> const& optional) {
+		if (optional) {
+			StreamValue(os, *optional);
+		} else {
+			os << "none";
+		}
+	}
+#endif
+}
+
+}
@@ -0,0 +1,136 @@
+/**
+ * @file encoding.h
+ *
+ * Implementation of hex and base64 manipulators
+ */
+
+#pragma once
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+namespace l3pp {
+
+namespace detail {
+	struct HexEncoding {
+		enum : std::size_t {
+			/// Bytes encoded per block.
+			InputBlock = 256,
+			/// Characters produced per block.
+			OutputBlock = 2 * InputBlock
+		};
+
+#if defined(__SSE2__)
+		/**
+		 * Converts 16 nibbles to their hex digits.
+		 */
+		static __m128i digits(__m128i nibbles) {
+			__m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+				_mm_set1_epi8('a' - '0' - 10));
+			return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+		}
+#endif
+
+		static char* encode(unsigned char const* in, std::size_t n, char* out) {
+#if defined(__SSE2__)
+			const __m128i mask = _mm_set1_epi8(0x0f);
+			for (; n >= 16; n -= 16, in += 16, out += 32) {
+				__m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in));
+				__m128i high = digits(_mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+				__m128i low = digits(_mm_and_si128(bytes, mask));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(high, low));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpackhi_epi8(high, low));
+			}
+#endif
+			static char const alphabet[] = "0123456789abcdef";
+			for (; n > 0; --n, ++in) {
+				*out++ = alphabet[*in >> 4];
+				*out++ = alphabet[*in & 0x0f];
+			}
+			return out;
+		}
+	};
+
+	struct Base64Encoding {
+		enum : std::size_t {
+			/// Bytes encoded per block, a multiple of 3 to avoid padding.
+			InputBlock = 384,
+			/// Characters produced per block.
+			OutputBlock = InputBlock / 3 * 4
+		};
+
+#if defined(__SSSE3__)
+		/**
+		 * Encodes 12 bytes, read from the lower 12 bytes of a 16 byte load,
+		 * into 16 characters.
+		 */
+		static __m128i encodeBlock(__m128i in) {
+			// Distribute the 3-byte groups over 32-bit lanes
+			in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+			// Move the four 6-bit values of each lane into separate bytes
+			__m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+			__m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+			__m128i indices = _mm_or_si128(t0, t1);
+			// Map the 6-bit values to characters by adding a per-range offset
+			__m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+			__m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+			range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+			const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+				'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+			return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+		}
+#endif
+
+		static char* encode(unsigned char const* in, std::size_t n, char* out) {
+#if defined(__SSSE3__)
+			for (; n >= 16; n -= 12, in += 12, out += 16) {
+				__m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out), encodeBlock(bytes));
+			}
+#endif
+			static char const alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+			for (; n >= 3; n -= 3, in += 3) {
+				*out++ = alphabet[in[0] >> 2];
+				*out++ = alphabet[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+				*out++ = alphabet[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+				*out++ = alphabet[in[2] & 0x3f];
+			}
+			if (n > 0) {
+				*out++ = alphabet[in[0] >> 2];
+				if (n == 1) {
+					*out++ = alphabet[(in[0] & 0x03) << 4];
+					*out++ = '=';
+				} else {
+					*out++ = alphabet[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+					*out++ = alphabet[(in[1] & 0x0f) << 2];
+				}
+				*out++ = '=';
+			}
+			return out;
+		}
+	};
+}
+
+template<typename Encoding>
+inline std::ostream& operator<<(std::ostream& os, EncodedBytes<Encoding> const& bytes) {
+	char buffer[Encoding::OutputBlock];
+	unsigned char const* in = bytes.data;
+	std::size_t remaining = bytes.length < bytes.maxBytes ? bytes.length : bytes.maxBytes;
+	while (remaining > 0) {
+		std::size_t n = remaining < Encoding::InputBlock ? remaining : std::size_t(Encoding::InputBlock);
+		char* end = Encoding::encode(in, n, buffer);
+		os.write(buffer, end - buffer);
+		in += n;
+		remaining -= n;
+	}
+	if (bytes.length > bytes.maxBytes) {
+		os << "...(+" << (bytes.length - bytes.maxBytes) << " bytes)";
+	}
+	return os;
+}
+
+}
@@ -12,6 +12,9 @@
 #include <iomanip>
 #include <sstream>
 #include <cstring> //strrchr
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace l3pp {
 
@@ -30,12 +33,193 @@ inline void Formatter::initialize() {
 	detail::GetStartTime();
 }
 
+inline std::string const& Formatter::formatLines(std::string const& prefix, std::string const& msg, std::string& buffer) const {
+	char const* data = msg.data();
+	std::size_t size = msg.size();
+	char const* newline = static_cast<char const*>(memchr(data, '\n', size));
+	// A single trailing newline does not start another line
+	if (multiLine == MultiLine::PLAIN || !newline || newline == data + size - 1) {
+		return msg;
+	}
+
+	// Only the part of the prefix on the line of the message is repeated
+	std::size_t lineStart = prefix.rfind('\n');
+	lineStart = lineStart == std::string::npos ? 0 : lineStart + 1;
+	std::string indent;
+	if (multiLine == MultiLine::INDENT) {
+		indent.assign(prefix.size() - lineStart, ' ');
+	} else {
+		indent.assign(prefix, lineStart, std::string::npos);
+	}
+
+	buffer.clear();
+	buffer.reserve(size + 4 * indent.size());
+	std::size_t pos = 0;
+	while (newline) {
+		std::size_t end = static_cast<std::size_t>(newline - data) + 1;
+		buffer.append(data + pos, end - pos);
+		pos = end;
+		if (pos == size) {
+			break;
+		}
+		buffer.append(indent);
+		newline = static_cast<char const*>(memchr(data + pos, '\n', size - pos));
+	}
+	buffer.append(data + pos, size - pos);
+	return buffer;
+}
+
 inline std::string Formatter::format(EntryContext const& context, std::string const& msg) const {
 	std::stringstream stream;
-	stream << context.level << " - " << msg << '\n';
+	stream << context.level << " - ";
+	std::string buffer;
+	stream << (multiLine == MultiLine::PLAIN ? msg : formatLines(stream.str(), msg, buffer));
+	if (context.stacktrace) {
+		stream << *context.stacktrace;
+	}
+	stream << '\n';
 	return stream.str();
 }
 
+namespace detail {
+	/**
+	 * Internal function to get the length of the printable ASCII prefix
+	 * (0x20 to 0x7e) of a string, which ends at a backslash as well.
+	 */
+	inline std::size_t PrintablePrefix(char const* data, std::size_t size) {
+		std::size_t i = 0;
+#if defined(__SSE2__)
+		// Bytes of 0x80 and above are negative, so a signed comparison
+		// catches them together with the control characters
+		const __m128i space = _mm_set1_epi8(0x20);
+		const __m128i del = _mm_set1_epi8(0x7f);
+		const __m128i backslash = _mm_set1_epi8('\\');
+		for (; i + 16 <= size; i += 16) {
+			__m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + i));
+			__m128i special = _mm_or_si128(_mm_cmplt_epi8(bytes, space),
+				_mm_or_si128(_mm_cmpeq_epi8(bytes, del), _mm_cmpeq_epi8(bytes, backslash)));
+			if (_mm_movemask_epi8(special) != 0) {
+				break;
+			}
+		}
+#endif
+		for (; i < size; ++i) {
+			unsigned char c = static_cast<unsigned char>(data[i]);
+			if (c < 0x20 || c >= 0x7f || c == '\\') {
+				break;
+			}
+		}
+		return i;
+	}
+
+	/**
+	 * Internal function to get the length of the valid UTF-8 sequence at
+	 * the start of a string, or 0 if it is not valid.
+	 */
+	inline std::size_t Utf8SequenceLength(unsigned char const* data, std::size_t size) {
+		unsigned char c = data[0];
+		std::size_t length;
+		unsigned char low = 0x80, high = 0xbf;
+		if (c >= 0xc2 && c <= 0xdf) {
+			length = 2;
+		} else if (c >= 0xe0 && c <= 0xef) {
+			length = 3;
+			if (c == 0xe0) {
+				low = 0xa0;
+			}
+			if (c == 0xed) {
+				high = 0x9f;
+			}
+		} else if (c >= 0xf0 && c <= 0xf4) {
+			length = 4;
+			if (c == 0xf0) {
+				low = 0x90;
+			}
+			if (c == 0xf4) {
+				high = 0x8f;
+			}
+		} else {
+			return 0;
+		}
+		if (size < length || data[1] < low || data[1] > high) {
+			return 0;
+		}
+		for (std::size_t i = 2; i < length; ++i) {
+			if (data[i] < 0x80 || data[i] > 0xbf) {
+				return 0;
+			}
+		}
+		return length;
+	}
+
+	/**
+	 * Internal function to get the length of the prefix of a string that
+	 * SanitizingFormatter passes on unchanged: printable ASCII other than
+	 * backslash, tabs, and valid UTF-8 sequences other than C1 control
+	 * characters.
+	 */
+	inline std::size_t CleanPrefix(char const* data, std::size_t size) {
+		std::size_t i = 0;
+		while (true) {
+			i += PrintablePrefix(data + i, size - i);
+			if (i == size) {
+				return i;
+			}
+			unsigned char const* bytes = reinterpret_cast<unsigned char const*>(data + i);
+			if (bytes[0] == '\t') {
+				++i;
+				continue;
+			}
+			std::size_t length = bytes[0] >= 0x80 ? Utf8SequenceLength(bytes, size - i) : 0;
+			// U+0080 to U+009F are C1 control characters
+			if (length == 0 || (bytes[0] == 0xc2 && bytes[1] < 0xa0)) {
+				return i;
+			}
+			i += length;
+		}
+	}
+
+	inline void AppendEscaped(std::string& out, unsigned char c) {
+		static char const digits[] = "0123456789abcdef";
+		switch (c) {
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += '\t'; break;
+			case '\\': out += "\\\\"; break;
+			default:
+				out += "\\x";
+				out += digits[c >> 4];
+				out += digits[c & 0x0f];
+		}
+	}
+}
+
+inline std::string SanitizingFormatter::sanitize(std::string const& msg) {
+	std::string result;
+	result.reserve(msg.size() + 16);
+	char const* data = msg.data();
+	std::size_t size = msg.size();
+	std::size_t i = 0;
+	while (i < size) {
+		std::size_t clean = detail::CleanPrefix(data + i, size - i);
+		result.append(data + i, clean);
+		i += clean;
+		if (i == size) {
+			break;
+		}
+		detail::AppendEscaped(result, static_cast<unsigned char>(data[i]));
+		++i;
+	}
+	return result;
+}
+
+inline std::string SanitizingFormatter::format(EntryContext const& context, std::string const& msg) const {
+	if (detail::CleanPrefix(msg.data(), msg.size()) == msg.size()) {
+		return (*formatter)(context, msg);
+	}
+	return (*formatter)(context, sanitize(msg));
+}
+
 template<Field field, int Width, Justification j, char Fill>
 inline void FieldStr<field, Width, j, Fill>::stream(std::ostream& os, EntryContext const& context, std::string const& msg) const {
 	os << std::setw(Width);
@@ -73,6 +257,11 @@ inline void FieldStr<field, Width, j, Fill>::stream(std::ostream& os, EntryConte
 		case Field::LogLevel:
 			os << context.level;
 			break;
+		case Field::StackTrace:
+			if (context.stacktrace) {
+				os << *context.stacktrace;
+			}
+			break;
 		case Field::WallTime:
 			auto runtime = context.timestamp - detail::GetStartTime();
 			os << std::chrono::duration_cast<std::chrono::milliseconds>(runtime).count();
@@ -82,7 +271,14 @@ inline void FieldStr<field, Width, j, Fill>::stream(std::ostream& os, EntryConte
 
 inline void TimeStr::stream(std::ostream& os, EntryContext const& context, std::string const&) const {
 	auto time = std::chrono::system_clock::to_time_t(context.timestamp);
-	auto timeinfo = localtime (&time);
+	// Sinks may format concurrently, see AsyncSink
+	std::tm tm;
+#ifdef _WIN32
+	localtime_s(&tm, &time);
+#else
+	localtime_r(&time, &tm);
+#endif
+	auto timeinfo = &tm;
 #if __GNUC__ >= 5 || __clang_major__ > 3 || (__clang_major__ == 3 && __clang_minor__ >= 7) || _MSC_VER >= 1700
 //TODO: Need better way to detect thing
 	os << std::put_time(timeinfo, formatStr.c_str());
@@ -8,8 +8,11 @@
 
 #include <vector>
 #include <algorithm>
+#include <atomic>
 #include <map>
+#include <mutex>
 #include <sstream>
+#include <unordered_map>
 
 namespace l3pp {
 
@@ -22,11 +25,215 @@ namespace detail {
 		static std::map<std::string, LogPtr> loggers;
 		return loggers;
 	}
+
+	/**
+	 * Level override of a ScopedVerbosity.
+	 */
+	struct VerbosityOverride {
+		std::string logger;
+		LogLevel level;
+	};
+
+	/**
+	 * Internal function to get whether the current thread has any
+	 * ScopedVerbosity, which is checked before any other work.
+	 */
+	inline bool& GetVerbosityActive() {
+		static thread_local bool active = false;
+		return active;
+	}
+
+	/**
+	 * Internal function to get the level overrides of the current thread,
+	 * innermost last.
+	 */
+	inline std::vector<VerbosityOverride>& GetVerbosityOverrides() {
+		static thread_local std::vector<VerbosityOverride> overrides;
+		return overrides;
+	}
+
+	/**
+	 * Entry held back by a RequestScope. The message is stored in the
+	 * arena of the thread.
+	 */
+	struct HeldEntry {
+		std::shared_ptr<Logger> logger;
+		EntryContext context;
+		std::size_t offset;
+		std::size_t size;
+	};
+
+	/**
+	 * Entries held back by the RequestScopes of a thread. Both containers
+	 * keep their capacity between requests, up to RetainedBytes each.
+	 */
+	struct RequestArena {
+		enum : std::size_t {
+			RetainedBytes = 65536
+		};
+
+		std::string data;
+		std::vector<HeldEntry> entries;
+		std::size_t depth;
+		/// Bytes of the held entries charged to the MemoryBudget.
+		std::size_t charged;
+
+		RequestArena() : depth(0), charged(0) {
+		}
+
+		static std::size_t getCost(HeldEntry const& entry) {
+			return sizeof(HeldEntry) + entry.size;
+		}
+
+		/// Releases memory of a large request once no scope is left.
+		void shrink() {
+			if (data.capacity() > RetainedBytes) {
+				std::string().swap(data);
+			}
+			if (entries.capacity() * sizeof(HeldEntry) > RetainedBytes) {
+				std::vector<HeldEntry>().swap(entries);
+			}
+		}
+	};
+
+	/**
+	 * Internal function to get whether the current thread has a
+	 * RequestScope, which is checked before any other work.
+	 */
+	inline bool& GetRequestScopeActive() {
+		static thread_local bool active = false;
+		return active;
+	}
+
+	inline RequestArena& GetRequestArena() {
+		static thread_local RequestArena arena;
+		return arena;
+	}
+
+	/**
+	 * Internal function to get the mutex guarding the loggers and the
+	 * eviction settings.
+	 */
+	static inline std::mutex& GetLoggersMutex() {
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	/**
+	 * Internal function to get the idle time after which loggers are
+	 * evicted. Should not be used directly, see Logger::setIdleEviction()
+	 */
+	static inline std::chrono::steady_clock::duration& GetIdleEviction() {
+		static std::chrono::steady_clock::duration idle = std::chrono::steady_clock::duration::zero();
+		return idle;
+	}
+
+	/**
+	 * Internal function to get the time of the last eviction sweep.
+	 */
+	static inline std::chrono::steady_clock::time_point& GetLastEviction() {
+		static std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+		return last;
+	}
+
+	/**
+	 * Internal function to get the generation of the registry, which
+	 * changes whenever cached lookups become invalid.
+	 */
+	static inline std::atomic<std::uint64_t>& GetLoggersGeneration() {
+		static std::atomic<std::uint64_t> generation(0);
+		return generation;
+	}
+
+	/**
+	 * Recent lookups of the current thread, such that looking up a logger by
+	 * name does not lock the registry. It is cleared once it holds
+	 * MaxLoggers, and its loggers count as used until then.
+	 */
+	struct LoggerCache {
+		enum : std::size_t {
+			MaxLoggers = 256
+		};
+
+		std::uint64_t generation;
+		std::unordered_map<std::string, LogPtr> loggers;
+
+		LoggerCache() : generation(0) {
+		}
+
+		~LoggerCache() {
+			clear();
+		}
+
+		void clear() {
+			auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+			for (auto const& logger: loggers) {
+				logger.second->lastUsed.store(now, std::memory_order_relaxed);
+			}
+			loggers.clear();
+		}
+	};
+
+	static inline LoggerCache& GetLoggerCache() {
+		static thread_local LoggerCache cache;
+		return cache;
+	}
+
+	/**
+	 * Internal function to get the number of dropped entries of the current
+	 * thread. Should not be used directly, see Logger::getDroppedCount()
+	 */
+	static inline std::size_t& GetDroppedCount() {
+		static thread_local std::size_t dropped = 0;
+		return dropped;
+	}
+
+	/**
+	 * Internal function to get the stack trace level. Should not be used
+	 * directly, see Logger::getStackTraceLevel()
+	 */
+	static inline LogLevel& GetStackTraceLevel() {
+		static LogLevel level = LogLevel::OFF;
+		return level;
+	}
+
+	inline char const* GetLoggerName(Logger const* logger) {
+		return logger ? logger->getName().c_str() : "";
+	}
+
+	/**
+	 * Internal function to hold back an entry if the current thread has a
+	 * RequestScope.
+	 * @return Whether the entry was held back.
+	 */
+	inline bool HoldEntry(Logger& logger, EntryContext const& context, std::string const& msg) {
+		if (!GetRequestScopeActive()) {
+			return false;
+		}
+		std::size_t cost = sizeof(HeldEntry) + msg.size();
+		if (!ReserveMemory(cost)) {
+			if (context.level < GetMemoryDropLevel()) {
+				++GetMemoryDropped();
+				return true;
+			}
+			// Written right away, without waiting for memory
+			return false;
+		}
+		auto& arena = GetRequestArena();
+		arena.entries.push_back(HeldEntry{logger.shared_from_this(), context, arena.data.size(), msg.size()});
+		arena.data.append(msg);
+		arena.charged += cost;
+		return true;
+	}
 }
 
 inline LogStream::~LogStream() {
 	if (level != LogLevel::OFF) {
-		logger.log(level, stream.str(), context);
+		if (status) {
+			*status = logger.tryLog(level, stream.str(), context);
+		} else {
+			logger.log(level, stream.str(), context);
+		}
 	}
 }
 
@@ -39,6 +246,132 @@ inline void Logger::logEntry(EntryContext const& context, std::string const& msg
 	}
 }
 
+inline LogStatus Logger::tryLogEntry(EntryContext const& context, std::string const& msg) {
+	LogStatus status = LogStatus::WRITTEN;
+	for(auto& sink: sinks) {
+		if (!sink->tryLog(context, msg)) {
+			status = LogStatus::DROPPED;
+		}
+	}
+	if (additive && parent) {
+		if (parent->tryLogEntry(context, msg) == LogStatus::DROPPED) {
+			status = LogStatus::DROPPED;
+		}
+	}
+	return status;
+}
+
+inline bool Logger::isEnabled(LogLevel level) const {
+	if (level >= getLevel()) {
+		return true;
+	}
+	if (!detail::GetVerbosityActive()) {
+		return false;
+	}
+	auto const& overrides = detail::GetVerbosityOverrides();
+	for (auto it = overrides.rbegin(); it != overrides.rend(); ++it) {
+		std::string const& prefix = it->logger;
+		if (prefix.empty() || name == prefix ||
+				(name.size() > prefix.size() && name[prefix.size()] == '.' && name.compare(0, prefix.size(), prefix) == 0)) {
+			return level >= it->level && level >= cap;
+		}
+	}
+	return false;
+}
+
+inline ScopedVerbosity::ScopedVerbosity(LogLevel level, std::string const& logger) {
+	detail::GetVerbosityOverrides().push_back(detail::VerbosityOverride{logger, level});
+	detail::GetVerbosityActive() = true;
+}
+
+inline ScopedVerbosity::~ScopedVerbosity() {
+	auto& overrides = detail::GetVerbosityOverrides();
+	overrides.pop_back();
+	detail::GetVerbosityActive() = !overrides.empty();
+}
+
+inline RequestScope::RequestScope() : verbosity(false) {
+	enter();
+}
+
+inline RequestScope::RequestScope(LogLevel level) : verbosity(true) {
+	detail::GetVerbosityOverrides().push_back(detail::VerbosityOverride{"", level});
+	detail::GetVerbosityActive() = true;
+	enter();
+}
+
+inline void RequestScope::enter() {
+	auto& arena = detail::GetRequestArena();
+	first = arena.entries.size();
+	offset = arena.data.size();
+	decided = false;
+	++arena.depth;
+	detail::GetRequestScopeActive() = true;
+}
+
+inline RequestScope::~RequestScope() {
+	if (!decided) {
+		auto const& entries = detail::GetRequestArena().entries;
+		bool failed = std::any_of(entries.begin() + static_cast<std::ptrdiff_t>(first), entries.end(),
+			[](detail::HeldEntry const& entry) { return entry.context.level >= LogLevel::ERR; });
+		if (failed) {
+			keep();
+		} else {
+			discard();
+		}
+	}
+	if (verbosity) {
+		auto& overrides = detail::GetVerbosityOverrides();
+		overrides.pop_back();
+		detail::GetVerbosityActive() = !overrides.empty();
+	}
+}
+
+inline void RequestScope::keep() {
+	if (decided) {
+		return;
+	}
+	decided = true;
+	auto& arena = detail::GetRequestArena();
+	if (--arena.depth > 0) {
+		// The entries now belong to the enclosing scope
+		return;
+	}
+	detail::GetRequestScopeActive() = false;
+	// The sinks charge the entries again while they hold them
+	detail::ReleaseMemory(arena.charged);
+	arena.charged = 0;
+	std::string msg;
+	for (auto const& entry: arena.entries) {
+		msg.assign(arena.data, entry.offset, entry.size);
+		entry.logger->logEntry(entry.context, msg);
+	}
+	arena.entries.clear();
+	arena.data.clear();
+	arena.shrink();
+}
+
+inline void RequestScope::discard() {
+	if (decided) {
+		return;
+	}
+	decided = true;
+	auto& arena = detail::GetRequestArena();
+	auto begin = arena.entries.begin() + static_cast<std::ptrdiff_t>(first);
+	std::size_t cost = 0;
+	for (auto entry = begin; entry != arena.entries.end(); ++entry) {
+		cost += detail::RequestArena::getCost(*entry);
+	}
+	detail::ReleaseMemory(cost);
+	arena.charged -= cost;
+	arena.entries.erase(begin, arena.entries.end());
+	arena.data.resize(offset);
+	detail::GetRequestScopeActive() = --arena.depth > 0;
+	if (arena.depth == 0) {
+		arena.shrink();
+	}
+}
+
 inline void Logger::removeSink(SinkPtr sink) {
 	std::vector<SinkPtr>::iterator pos = std::find(sinks.begin(), sinks.end(), sink);
 	if (pos != sinks.end()) {
@@ -47,17 +380,72 @@ inline void Logger::removeSink(SinkPtr sink) {
 }
 
 inline void Logger::log(LogLevel level, std::string const& msg, EntryContext context) {
-	if (level < getLevel()) {
+	if (!isEnabled(level)) {
+		L3PP_PROBE(level_reject, name.c_str(), level, 0);
 		return;
 	}
+	L3PP_PROBE(record_create, name.c_str(), level, msg.size());
+	__L3PP_ACCOUNT(this);
 
 	context.level = level;
 	context.logger = this;
+	if (level >= detail::GetStackTraceLevel() && !context.stacktrace) {
+		context.stacktrace = StackTrace::capture();
+	}
+	if (detail::HoldEntry(*this, context, msg)) {
+		return;
+	}
+	if (detail::GetRequestScopeActive()) {
+		// The budget is exhausted, and only the scope frees its memory
+		tryLogEntry(context, msg);
+		return;
+	}
 	logEntry(context, msg);
 }
 
+inline std::vector<SinkCost> Logger::estimateCost(LogLevel level, std::size_t records, std::size_t messageSize) const {
+	EntryContext context(__FILE__, __LINE__, __func__);
+	context.level = level;
+	context.logger = this;
+	if (level >= detail::GetStackTraceLevel()) {
+		context.stacktrace = StackTrace::capture();
+	}
+	std::string message(messageSize, ' ');
+	for (std::size_t i = 0; i < messageSize; ++i) {
+		if (i % 6 != 5) {
+			message[i] = static_cast<char>('a' + i % 26);
+		}
+	}
+
+	std::vector<SinkCost> costs;
+	for (Logger const* logger = this; logger; logger = logger->additive ? logger->parent.get() : nullptr) {
+		for (auto const& sink: logger->sinks) {
+			Sink const* formatting = sink.get();
+			if (auto async = dynamic_cast<AsyncSink const*>(formatting)) {
+				formatting = async->getSink().get();
+			}
+			// Warm up caches, e.g. of symbolized stack traces
+			formatting->formatMessage(context, message);
+			std::size_t bytes = 0;
+			auto start = std::chrono::steady_clock::now();
+			for (std::size_t i = 0; i < records; ++i) {
+				bytes += formatting->formatMessage(context, message).size();
+			}
+			auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+			SinkCost cost = {sink, 0, 0};
+			if (records > 0) {
+				cost.nsPerRecord = static_cast<double>(duration.count()) / records;
+				cost.bytesPerRecord = static_cast<double>(bytes) / records;
+			}
+			costs.push_back(cost);
+		}
+	}
+	return costs;
+}
+
 inline LogStream Logger::log(LogLevel level, EntryContext context) {
-	if (level < getLevel()) {
+	if (!isEnabled(level)) {
+		L3PP_PROBE(level_reject, name.c_str(), level, 0);
 		// Effectively disables the stream
 		return LogStream(*this, LogLevel::OFF, context);
 	} else {
@@ -65,6 +453,60 @@ inline LogStream Logger::log(LogLevel level, EntryContext context) {
 	}
 }
 
+inline LogStatus Logger::tryLog(LogLevel level, std::string const& msg, EntryContext context) {
+	if (!isEnabled(level)) {
+		L3PP_PROBE(level_reject, name.c_str(), level, 0);
+		return LogStatus::FILTERED;
+	}
+	L3PP_PROBE(record_create, name.c_str(), level, msg.size());
+	__L3PP_ACCOUNT(this);
+
+	context.level = level;
+	context.logger = this;
+	if (level >= detail::GetStackTraceLevel() && !context.stacktrace) {
+		context.stacktrace = StackTrace::capture();
+	}
+	if (detail::HoldEntry(*this, context, msg)) {
+		return LogStatus::WRITTEN;
+	}
+	return tryLogEntry(context, msg);
+}
+
+inline LogStream Logger::tryLog(LogLevel level, LogStatus& status, EntryContext context) {
+	if (!isEnabled(level)) {
+		L3PP_PROBE(level_reject, name.c_str(), level, 0);
+		status = LogStatus::FILTERED;
+		// Effectively disables the stream
+		return LogStream(*this, LogLevel::OFF, context);
+	} else {
+		status = LogStatus::WRITTEN;
+		return LogStream(*this, level, context, &status);
+	}
+}
+
+inline void Logger::setStackTraceLevel(LogLevel level) {
+	if (level == LogLevel::INHERIT) {
+		return;
+	}
+	detail::GetStackTraceLevel() = level;
+}
+
+inline LogLevel Logger::getStackTraceLevel() {
+	return detail::GetStackTraceLevel();
+}
+
+inline void Logger::setContainerLimit(std::size_t limit) {
+	detail::GetContainerLimit() = limit;
+}
+
+inline std::size_t Logger::getContainerLimit() {
+	return detail::GetContainerLimit();
+}
+
+inline std::size_t Logger::getDroppedCount() {
+	return detail::GetDroppedCount();
+}
+
 inline void Logger::initialize() {
 	// Setup root logger
 	getRootLogger();
@@ -73,7 +515,12 @@ inline void Logger::initialize() {
 }
 
 inline void Logger::deinitialize() {
-	detail::GetLoggers().clear();
+	{
+		std::lock_guard<std::mutex> lock(detail::GetLoggersMutex());
+		detail::GetLoggers().clear();
+		++detail::GetLoggersGeneration();
+	}
+	detail::GetLoggerCache().clear();
 	getRootLogger()->sinks.clear();
 }
 
@@ -87,28 +534,113 @@ inline LogPtr Logger::getLogger(std::string name) {
 		// Root logger
 		return getRootLogger();
 	}
+	auto& cache = detail::GetLoggerCache();
+	auto generation = detail::GetLoggersGeneration().load(std::memory_order_acquire);
+	if (cache.generation != generation) {
+		cache.clear();
+		cache.generation = generation;
+	}
+	// Cached loggers are not evicted, so they stay in the registry
+	auto it = cache.loggers.find(name);
+	if (it != cache.loggers.end()) {
+		return it->second;
+	}
+	if (cache.loggers.size() >= detail::LoggerCache::MaxLoggers) {
+		cache.clear();
+	}
+	LogPtr logger;
+	{
+		std::lock_guard<std::mutex> lock(detail::GetLoggersMutex());
+		logger = getLoggerLocked(name);
+	}
+	cache.loggers.emplace(name, logger);
+	return logger;
+}
+
+inline LogPtr Logger::getLoggerLocked(std::string const& name) {
 	auto& loggers = detail::GetLoggers();
+	auto now = std::chrono::steady_clock::now();
 	auto it = loggers.find(name);
+	auto idle = detail::GetIdleEviction();
+	bool evicting = idle > std::chrono::steady_clock::duration::zero();
 	if (it != loggers.end()) {
+		if (evicting) {
+			it->second->lastUsed.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+		}
 		return it->second;
 	} else {
+		if (evicting && now - detail::GetLastEviction() >= idle) {
+			evictLocked(now);
+		}
 		auto n = name.rfind('.');
 		LogPtr parent;
 		if (n == std::string::npos) {
 			parent = getRootLogger();
 		} else{
-			parent = getLogger(name.substr(0, n));
+			parent = getLoggerLocked(name.substr(0, n));
 		}
 		LogPtr newLogger = LogPtr(new Logger(name, parent));
+		newLogger->lastUsed.store(now.time_since_epoch().count(), std::memory_order_relaxed);
 		loggers.emplace(name, newLogger);
 		return newLogger;
 	}
 }
 
+inline void Logger::setConfigured() {
+	std::lock_guard<std::mutex> lock(detail::GetLoggersMutex());
+	configured = true;
+}
+
+inline std::size_t Logger::evictLocked(std::chrono::steady_clock::time_point now) {
+	auto& loggers = detail::GetLoggers();
+	auto idle = detail::GetIdleEviction();
+	detail::GetLastEviction() = now;
+	// Threads release their cached loggers for the next eviction
+	++detail::GetLoggersGeneration();
+	std::size_t evicted = 0;
+	// Children sort after their parents, so visiting the loggers in reverse
+	// releases a child's reference to its parent before the parent is seen.
+	auto it = loggers.end();
+	while (it != loggers.begin()) {
+		--it;
+		Logger const& logger = *it->second;
+		if (it->second.use_count() == 1 && !logger.configured &&
+				now - std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(
+					logger.lastUsed.load(std::memory_order_relaxed))) >= idle) {
+			it = loggers.erase(it);
+			++evicted;
+		}
+	}
+	return evicted;
+}
+
+inline void Logger::setIdleEviction(std::chrono::steady_clock::duration idle) {
+	{
+		std::lock_guard<std::mutex> lock(detail::GetLoggersMutex());
+		detail::GetIdleEviction() = idle;
+		// Threads release their cached loggers
+		++detail::GetLoggersGeneration();
+	}
+	detail::GetLoggerCache().clear();
+}
+
+inline std::chrono::steady_clock::duration Logger::getIdleEviction() {
+	std::lock_guard<std::mutex> lock(detail::GetLoggersMutex());
+	return detail::GetIdleEviction();
+}
+
+inline std::size_t Logger::evictIdleLoggers() {
+	std::lock_guard<std::mutex> lock(detail::GetLoggersMutex());
+	if (detail::GetIdleEviction() <= std::chrono::steady_clock::duration::zero()) {
+		return 0;
+	}
+	return evictLocked(std::chrono::steady_clock::now());
+}
+
 template<typename T>
 inline LogStream const& operator<<(LogStream const& stream, T const& val) {
 	if (stream.level != LogLevel::OFF) {
-		stream.stream << val;
+		detail::StreamValue(stream.stream, val);
 	}
 	return stream;
 }
@@ -10,6 +10,24 @@
 
 namespace l3pp {
 
+namespace detail {
+	/**
+	 * Internal function to get the name of a level without streams.
+	 */
+	inline char const* LevelName(LogLevel level) {
+		switch (level) {
+			case LogLevel::TRACE:   return "TRACE";
+			case LogLevel::DEBUG:   return "DEBUG";
+			case LogLevel::INFO:    return "INFO";
+			case LogLevel::WARN:    return "WARN";
+			case LogLevel::ERR:     return "ERROR";
+			case LogLevel::FATAL:   return "FATAL";
+			case LogLevel::OFF:     return "OFF";
+			default:                return "";
+		}
+	}
+}
+
 /**
  * Streaming operator for LogLevel.
  * @param os Output stream.
@@ -0,0 +1,202 @@
+/**
+ * @file profile.h
+ *
+ * Implementation of load profile recording and replay
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+
+namespace l3pp {
+
+namespace detail {
+	/**
+	 * Internal function to get the histogram bucket of a value, i.e. its
+	 * bit width.
+	 */
+	inline std::size_t HistogramBucket(std::uint64_t value) {
+		std::size_t bucket = 0;
+		while (value) {
+			++bucket;
+			value >>= 1;
+		}
+		return std::min<std::size_t>(bucket, LoadProfile::Buckets - 1);
+	}
+
+	/**
+	 * Internal function to draw a value uniformly from a histogram bucket.
+	 */
+	template<typename Random>
+	inline std::uint64_t SampleBucket(std::size_t bucket, Random& random) {
+		if (bucket == 0) {
+			return 0;
+		}
+		std::uint64_t low = std::uint64_t(1) << (bucket - 1);
+		std::uint64_t high = (low - 1) | low;
+		return std::uniform_int_distribution<std::uint64_t>(low, high)(random);
+	}
+
+	/**
+	 * Internal function to get a distribution over histogram buckets, or
+	 * over bucket 0 only if the histogram is empty.
+	 */
+	inline std::discrete_distribution<std::size_t> HistogramDistribution(std::vector<std::uint64_t> const& histogram) {
+		if (std::all_of(histogram.begin(), histogram.end(), [](std::uint64_t count) { return count == 0; })) {
+			return std::discrete_distribution<std::size_t>();
+		}
+		return std::discrete_distribution<std::size_t>(histogram.begin(), histogram.end());
+	}
+}
+
+inline void LoadProfile::save(std::ostream& os) const {
+	os << "l3pp-profile 1\n";
+	os << "threads " << threads << '\n';
+	os << "sizes";
+	for (auto count: sizes) {
+		os << ' ' << count;
+	}
+	os << "\ngaps";
+	for (auto count: gaps) {
+		os << ' ' << count;
+	}
+	os << "\nsites " << sites.size() << '\n';
+	for (auto const& site: sites) {
+		os << site.count << '\t' << static_cast<int>(site.level) << '\t' << site.line << '\t'
+			<< site.logger << '\t' << site.filename << '\t' << site.funcname << '\n';
+	}
+}
+
+inline LoadProfile LoadProfile::load(std::istream& is) {
+	LoadProfile profile;
+	std::string token;
+	int version = 0;
+	if (!(is >> token >> version) || token != "l3pp-profile" || version != 1) {
+		return LoadProfile();
+	}
+	if (!(is >> token >> profile.threads) || token != "threads") {
+		return LoadProfile();
+	}
+	for (auto histogram: {&profile.sizes, &profile.gaps}) {
+		if (!(is >> token)) {
+			return LoadProfile();
+		}
+		for (auto& count: *histogram) {
+			is >> count;
+		}
+	}
+	std::size_t count = 0;
+	if (!(is >> token >> count) || token != "sites") {
+		return LoadProfile();
+	}
+	is.ignore(1);
+	for (std::size_t i = 0; i < count; ++i) {
+		CallSite site;
+		int level;
+		std::string line;
+		if (!std::getline(is, line)) {
+			return LoadProfile();
+		}
+		std::istringstream fields(line);
+		fields >> site.count >> level >> site.line;
+		fields.ignore(1);
+		std::getline(fields, site.logger, '\t');
+		std::getline(fields, site.filename, '\t');
+		std::getline(fields, site.funcname);
+		if (!fields && !fields.eof()) {
+			return LoadProfile();
+		}
+		site.level = static_cast<LogLevel>(level);
+		profile.sites.push_back(site);
+	}
+	return profile;
+}
+
+inline LoadProfile::ReplayResult LoadProfile::replay(std::uint64_t entries, unsigned threads, bool timed) const {
+	ReplayResult result = {0, std::chrono::nanoseconds(0)};
+	if (sites.empty() || entries == 0) {
+		return result;
+	}
+	if (threads == 0) {
+		threads = this->threads > 0 ? this->threads : 1;
+	}
+
+	// Resolve loggers up front, such that threads do not create them
+	std::vector<LogPtr> loggers;
+	std::vector<double> weights;
+	for (auto const& site: sites) {
+		loggers.push_back(Logger::getLogger(site.logger));
+		weights.push_back(static_cast<double>(site.count));
+	}
+	bool haveGaps = timed && std::any_of(gaps.begin(), gaps.end(), [](std::uint64_t count) { return count > 0; });
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; ++t) {
+		std::uint64_t share = entries / threads + (t < entries % threads ? 1 : 0);
+		workers.emplace_back([this, &loggers, &weights, haveGaps, share, t]() {
+			std::mt19937_64 random(t + 1);
+			std::discrete_distribution<std::size_t> siteDistribution(weights.begin(), weights.end());
+			auto sizeDistribution = detail::HistogramDistribution(sizes);
+			auto gapDistribution = detail::HistogramDistribution(gaps);
+			std::string message;
+			for (std::uint64_t i = 0; i < share; ++i) {
+				if (haveGaps) {
+					auto gap = std::chrono::nanoseconds(detail::SampleBucket(gapDistribution(random), random));
+					// Sleeping is too coarse for short gaps
+					if (gap < std::chrono::microseconds(100)) {
+						auto until = std::chrono::steady_clock::now() + gap;
+						while (std::chrono::steady_clock::now() < until) {
+						}
+					} else {
+						std::this_thread::sleep_for(gap);
+					}
+				}
+				std::size_t index = siteDistribution(random);
+				CallSite const& site = sites[index];
+				std::uint64_t size = std::min<std::uint64_t>(detail::SampleBucket(sizeDistribution(random), random), 1 << 20);
+				message.assign(static_cast<std::size_t>(size), 'x');
+				loggers[index]->log(site.level, message,
+					EntryContext(site.filename.c_str(), site.line, site.funcname.c_str()));
+			}
+		});
+	}
+	for (auto& worker: workers) {
+		worker.join();
+	}
+	result.entries = entries;
+	result.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+	return result;
+}
+
+inline void ProfileSink::log(EntryContext const& context, std::string const& message) const {
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(mutex);
+	++sites[SiteKey(context.filename, context.line, context.funcname, detail::GetLoggerName(context.logger), context.level)];
+	++profile.sizes[detail::HistogramBucket(message.size())];
+	auto last = lastEntry.find(std::this_thread::get_id());
+	if (last != lastEntry.end()) {
+		auto gap = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last->second);
+		++profile.gaps[detail::HistogramBucket(static_cast<std::uint64_t>(gap.count()))];
+		last->second = now;
+	} else {
+		lastEntry.emplace(std::this_thread::get_id(), now);
+	}
+}
+
+inline LoadProfile ProfileSink::getProfile() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	LoadProfile result = profile;
+	result.threads = static_cast<unsigned>(lastEntry.size());
+	for (auto const& site: sites) {
+		LoadProfile::CallSite callSite;
+		std::tie(callSite.filename, callSite.line, callSite.funcname, callSite.logger, callSite.level) = site.first;
+		callSite.count = site.second;
+		result.sites.push_back(callSite);
+	}
+	return result;
+}
+
+}
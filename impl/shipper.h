@@ -0,0 +1,361 @@
+/**
+ * @file shipper.h
+ *
+ * Implementation of the LogShipper class
+ */
+
+#pragma once
+
+#if defined(__linux__)
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace l3pp {
+
+namespace detail {
+	/**
+	 * Blocks SIGPIPE on the current thread while sending to a socket whose
+	 * peer may have gone away, and discards a SIGPIPE raised meanwhile.
+	 */
+	class SigPipeBlocker {
+		sigset_t previous;
+		bool pending;
+
+	public:
+		SigPipeBlocker() {
+			sigset_t set;
+			sigemptyset(&set);
+			sigaddset(&set, SIGPIPE);
+			pthread_sigmask(SIG_BLOCK, &set, &previous);
+			sigset_t signals;
+			sigpending(&signals);
+			pending = sigismember(&signals, SIGPIPE) == 1;
+		}
+
+		~SigPipeBlocker() {
+			if (!pending) {
+				sigset_t set;
+				sigemptyset(&set);
+				sigaddset(&set, SIGPIPE);
+				struct timespec zero = {0, 0};
+				while (sigtimedwait(&set, nullptr, &zero) > 0) {
+				}
+			}
+			pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+		}
+	};
+
+	/**
+	 * Internal function to find the end of the last complete line in the
+	 * given range of a file.
+	 * @return The offset after the last newline, or begin if there is none.
+	 */
+	inline std::uint64_t FindLineEnd(int fd, std::uint64_t begin, std::uint64_t end) {
+		char buffer[4096];
+		while (end > begin) {
+			std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(end - begin, sizeof(buffer)));
+			if (pread(fd, buffer, n, static_cast<off_t>(end - n)) != static_cast<ssize_t>(n)) {
+				return begin;
+			}
+			for (std::size_t i = n; i > 0; --i) {
+				if (buffer[i - 1] == '\n') {
+					return end - n + i;
+				}
+			}
+			end -= n;
+		}
+		return begin;
+	}
+}
+
+inline LogShipper::LogShipper(std::string const& destination, std::string const& stateFile,
+		std::chrono::milliseconds interval) :
+	destination(destination), stateFile(stateFile), interval(interval),
+	socket(-1), stopping(false)
+{
+	loadState();
+	thread = std::thread(&LogShipper::run, this);
+}
+
+inline LogShipper::~LogShipper() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeup.notify_all();
+	thread.join();
+	disconnect();
+}
+
+inline bool LogShipper::connect() {
+	if (destination.compare(0, 5, "unix:") == 0) {
+		std::string path = destination.substr(5);
+		struct sockaddr_un address;
+		std::memset(&address, 0, sizeof(address));
+		if (path.size() >= sizeof(address.sun_path)) {
+			return false;
+		}
+		address.sun_family = AF_UNIX;
+		std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+		socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (socket >= 0 && ::connect(socket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0) {
+			disconnect();
+		}
+	} else if (destination.compare(0, 4, "tcp:") == 0) {
+		auto colon = destination.rfind(':');
+		if (colon <= 4) {
+			return false;
+		}
+		std::string host = destination.substr(4, colon - 4);
+		std::string port = destination.substr(colon + 1);
+		struct addrinfo hints;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		struct addrinfo* addresses = nullptr;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+			return false;
+		}
+		for (auto address = addresses; address && socket < 0; address = address->ai_next) {
+			socket = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+			if (socket >= 0 && ::connect(socket, address->ai_addr, address->ai_addrlen) != 0) {
+				disconnect();
+			}
+		}
+		freeaddrinfo(addresses);
+	}
+	if (socket < 0) {
+		return false;
+	}
+	// Do not block forever on a collector that stopped reading
+	struct timeval timeout = {5, 0};
+	setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	return true;
+}
+
+inline void LogShipper::disconnect() {
+	if (socket >= 0) {
+		close(socket);
+		socket = -1;
+	}
+}
+
+inline bool LogShipper::send(std::string const& filename, File& file) {
+	int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		return false;
+	}
+	std::uint64_t size = static_cast<std::uint64_t>(info.st_size);
+	if (static_cast<std::uint64_t>(info.st_ino) != file.inode || size < file.offset) {
+		// The file was replaced or truncated
+		file.inode = static_cast<std::uint64_t>(info.st_ino);
+		file.offset = 0;
+	}
+	std::uint64_t start = file.offset;
+	if (!file.complete) {
+		size = detail::FindLineEnd(fd, file.offset, size);
+	}
+	while (file.offset < size) {
+		off_t offset = static_cast<off_t>(file.offset);
+		ssize_t sent = sendfile(socket, fd, &offset, static_cast<std::size_t>(size - file.offset));
+		if (sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if (sent <= 0) {
+			disconnect();
+			close(fd);
+			return false;
+		}
+		file.offset = static_cast<std::uint64_t>(offset);
+	}
+	// Terminate the last line of a completed file, as the next file
+	// follows on the same connection
+	char last = '\n';
+	if (file.offset > start && pread(fd, &last, 1, static_cast<off_t>(file.offset - 1)) == 1 &&
+			last != '\n' && !sendAll("\n", 1)) {
+		close(fd);
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+inline bool LogShipper::sendAll(char const* data, std::size_t size) {
+	while (size > 0) {
+		ssize_t sent = ::send(socket, data, size, 0);
+		if (sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if (sent <= 0) {
+			disconnect();
+			return false;
+		}
+		data += sent;
+		size -= static_cast<std::size_t>(sent);
+	}
+	return true;
+}
+
+inline void LogShipper::loadState() {
+	std::ifstream in(stateFile);
+	std::string token;
+	int version = 0;
+	if (!(in >> token >> version) || token != "l3pp-shipper" || version != 1) {
+		return;
+	}
+	in.ignore(1);
+	std::string line;
+	while (std::getline(in, line)) {
+		std::istringstream fields(line);
+		File file;
+		std::string filename;
+		fields >> file.inode >> file.offset >> file.complete;
+		fields.ignore(1);
+		if (fields && std::getline(fields, filename) && !filename.empty()) {
+			files[filename] = file;
+		}
+	}
+}
+
+inline void LogShipper::saveState() const {
+	// Replace the state atomically, such that a crash leaves a valid state
+	std::string temporary = stateFile + ".tmp";
+	{
+		std::ofstream out(temporary, std::ios::out | std::ios::trunc);
+		out << "l3pp-shipper 1\n";
+		for (auto const& file: files) {
+			out << file.second.inode << '\t' << file.second.offset << '\t'
+				<< file.second.complete << '\t' << file.first << '\n';
+		}
+		if (!out.flush()) {
+			return;
+		}
+	}
+	std::rename(temporary.c_str(), stateFile.c_str());
+}
+
+inline void LogShipper::ship(std::string const& filename) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = files.find(filename);
+		if (it == files.end()) {
+			files[filename] = File{true, 0, 0};
+		} else {
+			it->second.complete = true;
+		}
+		saveState();
+	}
+	wakeup.notify_all();
+}
+
+inline void LogShipper::follow(std::string const& filename) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = files.find(filename);
+	if (it == files.end()) {
+		files[filename] = File{false, 0, 0};
+	} else {
+		it->second.complete = false;
+	}
+	saveState();
+}
+
+inline void LogShipper::unfollow(std::string const& filename) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = files.find(filename);
+	if (it != files.end() && !it->second.complete) {
+		files.erase(it);
+		saveState();
+	}
+}
+
+inline bool LogShipper::transfer() {
+	std::lock_guard<std::mutex> transferLock(transferMutex);
+	std::map<std::string, File> pass;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pass = files;
+	}
+
+	detail::SigPipeBlocker blocker;
+	bool done = true;
+	std::vector<std::string> deleted;
+	for (auto& file: pass) {
+		struct stat info;
+		if (file.second.complete && stat(file.first.c_str(), &info) != 0 && errno == ENOENT) {
+			deleted.push_back(file.first);
+			continue;
+		}
+		if (socket < 0 && !connect()) {
+			done = false;
+			break;
+		}
+		if (!send(file.first, file.second)) {
+			done = false;
+		}
+	}
+
+	// Files may have been registered or unfollowed meanwhile
+	std::lock_guard<std::mutex> lock(mutex);
+	bool changed = false;
+	for (auto const& filename: deleted) {
+		auto it = files.find(filename);
+		if (it != files.end() && it->second.complete) {
+			files.erase(it);
+			changed = true;
+		}
+	}
+	for (auto const& file: pass) {
+		auto it = files.find(file.first);
+		if (it != files.end() && (it->second.offset != file.second.offset || it->second.inode != file.second.inode)) {
+			it->second.inode = file.second.inode;
+			it->second.offset = file.second.offset;
+			changed = true;
+		}
+	}
+	if (changed) {
+		saveState();
+	}
+	return done;
+}
+
+inline std::uint64_t LogShipper::getOffset(std::string const& filename) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = files.find(filename);
+	return it == files.end() ? 0 : it->second.offset;
+}
+
+inline void LogShipper::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping) {
+		lock.unlock();
+		transfer();
+		lock.lock();
+		wakeup.wait_for(lock, interval, [this]() { return stopping; });
+	}
+}
+
+}
+
+#endif
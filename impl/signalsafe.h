@@ -0,0 +1,106 @@
+/**
+ * @file signalsafe.h
+ *
+ * Implementation of the SignalSafeEntry class
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace l3pp {
+
+namespace detail {
+	/**
+	 * Internal function to get the default file descriptor of
+	 * SignalSafeEntry. Constant initialized, hence safe in signal handlers.
+	 */
+	inline std::atomic<int>& GetSignalSafeFd() {
+		static std::atomic<int> fd(2);
+		return fd;
+	}
+}
+
+inline SignalSafeEntry::SignalSafeEntry(LogLevel level, int fd) :
+		size(0), fd(fd < 0 ? detail::GetSignalSafeFd().load() : fd)
+{
+	*this << detail::LevelName(level) << " - ";
+}
+
+inline SignalSafeEntry::~SignalSafeEntry() {
+	int error = errno;
+	buffer[size++] = '\n';
+	char const* data = buffer;
+	std::size_t remaining = size;
+	while (remaining > 0) {
+#if defined(_WIN32)
+		int written = _write(fd, data, static_cast<unsigned>(remaining));
+#else
+		ssize_t written = ::write(fd, data, remaining);
+#endif
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			break;
+		}
+		data += written;
+		remaining -= static_cast<std::size_t>(written);
+	}
+	errno = error;
+}
+
+inline SignalSafeEntry& SignalSafeEntry::append(char const* data, std::size_t length) {
+	// Keep space for the newline
+	std::size_t space = Capacity - 1 - size;
+	if (length > space) {
+		length = space;
+	}
+	for (std::size_t i = 0; i < length; ++i) {
+		buffer[size + i] = data[i];
+	}
+	size += length;
+	return *this;
+}
+
+inline SignalSafeEntry& SignalSafeEntry::operator<<(char const* str) {
+	std::size_t length = 0;
+	while (str[length] != '\0') {
+		++length;
+	}
+	return append(str, length);
+}
+
+inline SignalSafeEntry& SignalSafeEntry::operator<<(void const* pointer) {
+	append("0x", 2);
+	appendUnsigned(reinterpret_cast<std::uintptr_t>(pointer), 16);
+	return *this;
+}
+
+inline void SignalSafeEntry::appendUnsigned(unsigned long long value, unsigned base) {
+	static char const digits[] = "0123456789abcdef";
+	char text[64];
+	std::size_t length = 0;
+	do {
+		text[sizeof(text) - ++length] = digits[value % base];
+		value /= base;
+	} while (value > 0);
+	append(text + sizeof(text) - length, length);
+}
+
+inline void SignalSafeEntry::setFd(int fd) {
+	detail::GetSignalSafeFd() = fd;
+}
+
+inline int SignalSafeEntry::getFd() {
+	return detail::GetSignalSafeFd();
+}
+
+}
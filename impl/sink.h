@@ -0,0 +1,362 @@
+/**
+ * @file sink.h
+ *
+ * Implementation of Sink classes
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+namespace l3pp {
+
+namespace detail {
+	/// Magic bytes at the start of a CircularFileSink file.
+	static char const CircularFileMagic[8] = {'L', '3', 'P', 'P', 'R', 'I', 'N', 'G'};
+
+	/**
+	 * Internal functions to store header fields independent of the
+	 * platform's byte order.
+	 */
+	inline void EncodeUInt64(char* out, std::uint64_t value) {
+		for (int i = 0; i < 8; ++i) {
+			out[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+		}
+	}
+
+	inline std::uint64_t DecodeUInt64(char const* in) {
+		std::uint64_t value = 0;
+		for (int i = 0; i < 8; ++i) {
+			value |= static_cast<std::uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+		}
+		return value;
+	}
+
+	/**
+	 * Part of a RoutingFileSink path pattern.
+	 */
+	struct PathPatternPart {
+		enum Kind { Literal, LoggerName, Level, Component };
+		Kind kind;
+		std::string text;
+		std::size_t component;
+	};
+
+	/**
+	 * Internal function to append a value to a path, such that it does not
+	 * introduce directories or refer to the current or parent directory.
+	 */
+	inline void AppendPathValue(std::string& path, char const* begin, char const* end) {
+		if ((end - begin == 1 && begin[0] == '.') || (end - begin == 2 && begin[0] == '.' && begin[1] == '.')) {
+			path.append(static_cast<std::size_t>(end - begin), '_');
+			return;
+		}
+		for (; begin != end; ++begin) {
+			path += (*begin == '/' || *begin == '\\') ? '_' : *begin;
+		}
+	}
+}
+
+inline CircularFileSink::CircularFileSink(std::string const& filename, std::uint64_t size) :
+		level(LogLevel::ALL),
+		capacity(size > HeaderSize ? size - HeaderSize : 1),
+		head(0), wrapped(false)
+{
+	// Continue an existing file of the same size
+	file.open(filename, std::ios::in | std::ios::out | std::ios::binary);
+	if (file) {
+		char header[HeaderSize];
+		if (file.read(header, HeaderSize) &&
+				std::equal(header, header + 8, detail::CircularFileMagic) &&
+				detail::DecodeUInt64(header + 8) == capacity) {
+			head = detail::DecodeUInt64(header + 16);
+			wrapped = (detail::DecodeUInt64(header + 24) & 1) != 0;
+			if (head < capacity) {
+				return;
+			}
+		}
+		file.close();
+	}
+
+	// Create a new file and allocate it completely
+	file.clear();
+	file.open(filename, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	char zeros[4096] = {};
+	std::uint64_t remaining = HeaderSize + capacity;
+	while (remaining > 0 && file) {
+		std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(remaining, sizeof(zeros)));
+		file.write(zeros, n);
+		remaining -= n;
+	}
+	head = 0;
+	wrapped = false;
+	writeHeader();
+	file.flush();
+}
+
+inline void CircularFileSink::writeData(char const* data, std::size_t size) const {
+	file.seekp(static_cast<std::streamoff>(HeaderSize + head));
+	file.write(data, size);
+}
+
+inline void CircularFileSink::writeHeader() const {
+	char header[HeaderSize] = {};
+	std::copy(detail::CircularFileMagic, detail::CircularFileMagic + 8, header);
+	detail::EncodeUInt64(header + 8, capacity);
+	detail::EncodeUInt64(header + 16, head);
+	detail::EncodeUInt64(header + 24, wrapped ? 1 : 0);
+	file.seekp(0);
+	file.write(header, HeaderSize);
+}
+
+inline void CircularFileSink::log(EntryContext const& context, std::string const& message) const {
+	if (context.level < this->level) {
+		return;
+	}
+	write(context, message, formatMessage(context, message));
+}
+
+inline void CircularFileSink::write(EntryContext const& context, std::string const&, std::string const& formatted) const {
+	if (context.level < this->level) {
+		return;
+	}
+	L3PP_PROBE(write_start, detail::GetLoggerName(context.logger), context.level, formatted.size());
+
+	// Only the tail of an entry larger than the file is kept
+	char const* data = formatted.data();
+	std::size_t size = formatted.size();
+	if (size > capacity) {
+		data += size - capacity;
+		size = static_cast<std::size_t>(capacity);
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	while (size > 0) {
+		std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(size, capacity - head));
+		writeData(data, n);
+		data += n;
+		size -= n;
+		head += n;
+		if (head == capacity) {
+			head = 0;
+			wrapped = true;
+		}
+	}
+	writeHeader();
+	file.flush();
+
+	L3PP_PROBE(write_end, detail::GetLoggerName(context.logger), context.level, formatted.size());
+}
+
+inline std::string CircularFileSink::read(std::string const& filename) {
+	std::ifstream in(filename, std::ios::in | std::ios::binary);
+	char header[HeaderSize];
+	if (!in.read(header, HeaderSize) || !std::equal(header, header + 8, detail::CircularFileMagic)) {
+		return "";
+	}
+	std::uint64_t capacity = detail::DecodeUInt64(header + 8);
+	std::uint64_t head = detail::DecodeUInt64(header + 16);
+	bool wrapped = (detail::DecodeUInt64(header + 24) & 1) != 0;
+	if (head >= capacity) {
+		return "";
+	}
+
+	std::string data(static_cast<std::size_t>(wrapped ? capacity : head), '\0');
+	if (!in.read(&data[0], static_cast<std::streamsize>(data.size()))) {
+		return "";
+	}
+	if (!wrapped) {
+		return data;
+	}
+	// Rotate the oldest data to the front and skip the first, possibly
+	// partially overwritten, entry
+	std::rotate(data.begin(), data.begin() + static_cast<std::ptrdiff_t>(head), data.end());
+	std::size_t start = data.find('\n');
+	return start == std::string::npos ? "" : data.substr(start + 1);
+}
+
+inline RoutingFileSink::RoutingFileSink(Router router, std::size_t maxOpen,
+		std::chrono::steady_clock::duration idleTimeout) :
+	level(LogLevel::ALL), router(router), maxOpen(std::max<std::size_t>(maxOpen, 1)),
+	idleTimeout(idleTimeout), bufferSize(65536), lastSweep(std::chrono::steady_clock::now())
+{
+}
+
+inline RoutingFileSink::~RoutingFileSink() {
+	std::lock_guard<std::mutex> lock(mutex);
+	while (!files.empty()) {
+		close(std::prev(files.end()));
+	}
+}
+
+inline RoutingFileSink::File* RoutingFileSink::getFile(std::string const& path) const {
+	auto now = std::chrono::steady_clock::now();
+	closeIdle(now);
+	auto it = index.find(path);
+	if (it != index.end()) {
+		files.splice(files.begin(), files, it->second);
+		it->second->lastUsed = now;
+		return &*it->second;
+	}
+	if (files.size() >= maxOpen) {
+		close(std::prev(files.end()));
+	}
+	files.emplace_front();
+	File& file = files.front();
+	file.stream.open(path, std::ios::out | std::ios::app | std::ios::binary);
+	if (!file.stream) {
+		files.pop_front();
+		return nullptr;
+	}
+	file.path = path;
+	file.lastUsed = now;
+	index[path] = files.begin();
+	return &file;
+}
+
+inline void RoutingFileSink::writePending(File& file) const {
+	if (!file.pending.empty()) {
+		file.stream.write(file.pending.data(), static_cast<std::streamsize>(file.pending.size()));
+		detail::ReleaseMemory(file.pending.size());
+		file.pending.clear();
+	}
+}
+
+inline void RoutingFileSink::close(std::list<File>::iterator it) const {
+	writePending(*it);
+	index.erase(it->path);
+	files.erase(it);
+}
+
+inline void RoutingFileSink::closeIdle(std::chrono::steady_clock::time_point now) const {
+	if (idleTimeout <= std::chrono::steady_clock::duration::zero() || now - lastSweep < idleTimeout / 2) {
+		return;
+	}
+	lastSweep = now;
+	while (!files.empty() && now - files.back().lastUsed >= idleTimeout) {
+		close(std::prev(files.end()));
+	}
+}
+
+inline bool RoutingFileSink::append(EntryContext const& context, std::string const& formatted, WriteMode mode) const {
+	std::string path = router(context);
+	if (path.empty()) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	File* file = getFile(path);
+	if (!file) {
+		return false;
+	}
+	L3PP_PROBE(write_start, detail::GetLoggerName(context.logger), context.level, formatted.size());
+	if (mode == WriteMode::BUFFERED && detail::ReserveMemory(formatted.size())) {
+		file->pending += formatted;
+		if (file->pending.size() >= bufferSize) {
+			writePending(*file);
+		}
+	} else {
+		// Also bypasses the buffer while the MemoryBudget is exhausted
+		writePending(*file);
+		file->stream << formatted;
+		if (mode == WriteMode::FLUSH) {
+			file->stream.flush();
+		}
+	}
+	L3PP_PROBE(write_end, detail::GetLoggerName(context.logger), context.level, formatted.size());
+	return !file->stream.fail();
+}
+
+inline void RoutingFileSink::log(EntryContext const& context, std::string const& message) const {
+	if (context.level >= this->level) {
+		append(context, formatMessage(context, message), WriteMode::FLUSH);
+	}
+}
+
+inline bool RoutingFileSink::tryLog(EntryContext const& context, std::string const& message) const {
+	if (context.level < this->level) {
+		return true;
+	}
+	return append(context, formatMessage(context, message), WriteMode::DIRECT);
+}
+
+inline void RoutingFileSink::write(EntryContext const& context, std::string const&, std::string const& formatted) const {
+	if (context.level >= this->level) {
+		append(context, formatted, WriteMode::BUFFERED);
+	}
+}
+
+inline void RoutingFileSink::flush() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& file: files) {
+		writePending(file);
+		file.stream.flush();
+	}
+	closeIdle(std::chrono::steady_clock::now());
+}
+
+inline std::size_t RoutingFileSink::getOpenFiles() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return files.size();
+}
+
+inline RoutingFileSink::Router RoutingFileSink::makeRouter(std::string const& pattern) {
+	typedef detail::PathPatternPart Part;
+	std::vector<Part> parts;
+	std::size_t pos = 0;
+	while (pos < pattern.size()) {
+		auto open = pattern.find('{', pos);
+		auto close = open == std::string::npos ? open : pattern.find('}', open);
+		if (close == std::string::npos) {
+			parts.push_back(Part{Part::Literal, pattern.substr(pos), 0});
+			break;
+		}
+		if (open > pos) {
+			parts.push_back(Part{Part::Literal, pattern.substr(pos, open - pos), 0});
+		}
+		std::string name = pattern.substr(open + 1, close - open - 1);
+		if (name == "logger") {
+			parts.push_back(Part{Part::LoggerName, "", 0});
+		} else if (name == "level") {
+			parts.push_back(Part{Part::Level, "", 0});
+		} else if (!name.empty() && name.find_first_not_of("0123456789") == std::string::npos) {
+			parts.push_back(Part{Part::Component, "", static_cast<std::size_t>(std::stoul(name))});
+		} else {
+			// Unknown placeholders are kept literally
+			parts.push_back(Part{Part::Literal, pattern.substr(open, close - open + 1), 0});
+		}
+		pos = close + 1;
+	}
+
+	return [parts](EntryContext const& context) {
+		char const* name = detail::GetLoggerName(context.logger);
+		std::string path;
+		for (auto const& part: parts) {
+			switch (part.kind) {
+				case Part::Literal:
+					path += part.text;
+					break;
+				case Part::LoggerName:
+					detail::AppendPathValue(path, name, name + std::strlen(name));
+					break;
+				case Part::Level:
+					path += detail::LevelName(context.level);
+					break;
+				case Part::Component: {
+					char const* begin = name;
+					for (std::size_t i = 0; i < part.component && *begin; ++i) {
+						begin = std::strchr(begin, '.');
+						begin = begin ? begin + 1 : name + std::strlen(name);
+					}
+					char const* end = std::strchr(begin, '.');
+					detail::AppendPathValue(path, begin, end ? end : begin + std::strlen(begin));
+					break;
+				}
+			}
+		}
+		return path;
+	};
+}
+
+}
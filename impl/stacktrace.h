@@ -0,0 +1,86 @@
+/**
+ * @file stacktrace.h
+ *
+ * Implementation of stack trace capturing and symbolization
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#define L3PP_HAVE_BACKTRACE
+#endif
+
+namespace l3pp {
+
+inline std::shared_ptr<StackTrace const> StackTrace::capture(std::size_t skip) {
+#ifdef L3PP_HAVE_BACKTRACE
+	// Also skip this function
+	skip = std::min<std::size_t>(skip, MaxDepth) + 1;
+	void* buffer[2 * MaxDepth + 1];
+	int captured = backtrace(buffer, static_cast<int>(MaxDepth + skip));
+	if (captured <= static_cast<int>(skip)) {
+		return nullptr;
+	}
+	std::shared_ptr<StackTrace> trace(new StackTrace());
+	for (int i = static_cast<int>(skip); i < captured; ++i) {
+		trace->frames[trace->depth++] = buffer[i];
+	}
+	return trace;
+#else
+	(void)skip;
+	return nullptr;
+#endif
+}
+
+inline std::string const& StackTrace::symbolize(void* address) {
+	static std::mutex mutex;
+	static std::unordered_map<void*, std::string> cache;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = cache.find(address);
+	if (it != cache.end()) {
+		return it->second;
+	}
+
+	std::ostringstream os;
+	os << address;
+#ifdef L3PP_HAVE_BACKTRACE
+	Dl_info info;
+	if (dladdr(address, &info) && info.dli_fname) {
+		char const* module = strrchr(info.dli_fname, '/');
+		module = module ? module + 1 : info.dli_fname;
+		if (info.dli_sname && info.dli_saddr) {
+			int status = 0;
+			char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+			os << ' ' << (status == 0 && demangled ? demangled : info.dli_sname) << "+0x" << std::hex
+				<< (static_cast<char*>(address) - static_cast<char*>(info.dli_saddr))
+				<< " (" << module << ')';
+			free(demangled);
+		} else {
+			os << " (" << module << "+0x" << std::hex
+				<< (static_cast<char*>(address) - static_cast<char*>(info.dli_fbase)) << ')';
+		}
+	}
+#endif
+	return cache.emplace(address, os.str()).first->second;
+}
+
+inline std::ostream& operator<<(std::ostream& os, StackTrace const& trace) {
+	for (std::size_t i = 0; i < trace.size(); ++i) {
+		os << "\n\t#" << i << ' ' << StackTrace::symbolize(trace[i]);
+	}
+	return os;
+}
+
+}
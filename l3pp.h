@@ -12,8 +12,9 @@
  * The basic components are Sinks, Formatters and Loggers.
  *
  * A Sink represents a logging output like a terminal or a log file.
- * This implementation provides a FileSink and a StreamSink, but the basic
- * Sink class can be extended as necessary.
+ * This implementation provides a StreamSink, a CircularFileSink and a
+ * RoutingFileSink, as well as an AsyncSink that writes to another sink from
+ * worker threads, but the basic Sink class can be extended as necessary.
  *
  * A Formatter is associated with a Sink and produces the actual string that is
  * sent to the Sink.
@@ -39,6 +40,11 @@
  * <li>`L3PP_LOG_<LVL>(logger, msg)` produces a normal log message where
  * logger should be string identifying the logger (or a LogPtr) and msg is the
  * message to be logged.</li>
+ * <li>`L3PP_TRYLOG_<LVL>(logger, msg)` behaves like `L3PP_LOG_<LVL>`, but uses
+ * Logger::tryLog(). Entries that are dropped are counted per thread, see
+ * Logger::getDroppedCount().</li>
+ * <li>`L3PP_DECLARE_LOGGER(var, name, cap)` declares a StaticLogger, whose
+ * entries below the cap are removed at compile time.</li>
  * </ul>
  * Any message (`msg`) can be an arbitrary expression that one would
  * stream to an `std::ostream` like `stream << (msg);`. The default formatter
@@ -83,6 +89,18 @@ enum class LogLevel {
 	ALL = TRACE
 };
 
+/**
+ * Result of a logging attempt, see Logger::tryLog().
+ */
+enum class LogStatus {
+	/// The entry was passed to all sinks.
+	WRITTEN,
+	/// The entry was filtered out by the log level.
+	FILTERED,
+	/// The entry could not be written by at least one sink.
+	DROPPED
+};
+
 /**
  * Streaming operator for LogLevel.
  * @param os Output stream.
@@ -92,6 +110,7 @@ enum class LogLevel {
 inline std::ostream& operator<<(std::ostream& os, LogLevel level);
 
 class Logger;
+class StackTrace;
 
 /**
  * Contextual information for a new log entry, contains such this as location,
@@ -111,6 +130,9 @@ struct EntryContext {
 	Logger const* logger;
 	LogLevel level;
 
+	// Raw stack trace, if captured (see Logger::setStackTraceLevel())
+	std::shared_ptr<StackTrace const> stacktrace;
+
 	EntryContext(const char* filename, size_t line, const char* funcname) :
 		filename(filename), line(line), funcname(funcname),
 		timestamp(std::chrono::system_clock::now()), logger(nullptr),
@@ -128,13 +150,32 @@ struct EntryContext {
 
 }
 
+#include "probes.h"
+#include "accounting.h"
+#include "stacktrace.h"
+#include "encoding.h"
 #include "formatter.h"
 #include "sink.h"
 #include "logger.h"
+#include "profile.h"
+#include "budget.h"
+#include "async.h"
+#include "shipper.h"
+#include "signalsafe.h"
 
 #include "impl/logging.h"
+#include "impl/container.h"
+#include "impl/budget.h"
 #include "impl/logger.h"
 #include "impl/formatter.h"
+#include "impl/sink.h"
+#include "impl/profile.h"
+#include "impl/async.h"
+#include "impl/shipper.h"
+#include "impl/signalsafe.h"
+#include "impl/accounting.h"
+#include "impl/stacktrace.h"
+#include "impl/encoding.h"
 
 #ifdef _MSC_VER
 #define __func__ __FUNCTION__
@@ -142,14 +183,42 @@ struct EntryContext {
 
 /// Create a record info.
 #define __L3PP_LOG_RECORD l3pp::EntryContext(__FILE__, __LINE__, __func__)
+/// Compile-time level cap of a logger, see StaticLogger.
+#define __L3PP_LEVEL_CAP(channel) \
+    ::l3pp::detail::LevelCap<typename std::decay<decltype(channel)>::type>::get()
 /// Basic logging macro.
 #define __L3PP_LOG(level, channel, expr) do { \
+    if (__L3PP_LEVEL_CAP(channel) > level) { \
+        break; \
+    } \
     auto L3PP_channel = ::l3pp::Logger::getLogger(channel); \
-    if (L3PP_channel->getLevel() <= level) { \
+    if (L3PP_channel->isEnabled(level)) { \
         L3PP_channel->log(level, __L3PP_LOG_RECORD) << expr; \
+    } else { \
+        L3PP_PROBE(level_reject, L3PP_channel->getName().c_str(), level, 0); \
     } \
 } while(false)
 
+/// Basic non-blocking logging macro, counts dropped entries.
+#define __L3PP_TRYLOG(level, channel, expr) do { \
+    if (__L3PP_LEVEL_CAP(channel) > level) { \
+        break; \
+    } \
+    auto L3PP_channel = ::l3pp::Logger::getLogger(channel); \
+    if (L3PP_channel->isEnabled(level)) { \
+        ::l3pp::LogStatus L3PP_status; \
+        L3PP_channel->tryLog(level, L3PP_status, __L3PP_LOG_RECORD) << expr; \
+        if (L3PP_status == ::l3pp::LogStatus::DROPPED) { \
+            ++::l3pp::detail::GetDroppedCount(); \
+        } \
+    } else { \
+        L3PP_PROBE(level_reject, L3PP_channel->getName().c_str(), level, 0); \
+    } \
+} while(false)
+
+/// Declare a logger with a compile-time level cap, see StaticLogger.
+#define L3PP_DECLARE_LOGGER(var, name, cap) static ::l3pp::StaticLogger<cap> var(name)
+
 /// Log with level TRACE.
 #define L3PP_LOG_TRACE(channel, expr) __L3PP_LOG(::l3pp::LogLevel::TRACE, channel, expr)
 /// Log with level DEBUG.
@@ -162,3 +231,16 @@ struct EntryContext {
 #define L3PP_LOG_ERROR(channel, expr) __L3PP_LOG(::l3pp::LogLevel::ERR, channel, expr)
 /// Log with level FATAL.
 #define L3PP_LOG_FATAL(channel, expr) __L3PP_LOG(::l3pp::LogLevel::FATAL, channel, expr)
+
+/// Try to log with level TRACE.
+#define L3PP_TRYLOG_TRACE(channel, expr) __L3PP_TRYLOG(::l3pp::LogLevel::TRACE, channel, expr)
+/// Try to log with level DEBUG.
+#define L3PP_TRYLOG_DEBUG(channel, expr) __L3PP_TRYLOG(::l3pp::LogLevel::DEBUG, channel, expr)
+/// Try to log with level INFO.
+#define L3PP_TRYLOG_INFO(channel, expr) __L3PP_TRYLOG(::l3pp::LogLevel::INFO, channel, expr)
+/// Try to log with level WARN.
+#define L3PP_TRYLOG_WARN(channel, expr) __L3PP_TRYLOG(::l3pp::LogLevel::WARN, channel, expr)
+/// Try to log with level ERROR.
+#define L3PP_TRYLOG_ERROR(channel, expr) __L3PP_TRYLOG(::l3pp::LogLevel::ERR, channel, expr)
+/// Try to log with level FATAL.
+#define L3PP_TRYLOG_FATAL(channel, expr) __L3PP_TRYLOG(::l3pp::LogLevel::FATAL, channel, expr)
@@ -6,11 +6,18 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <vector>
 #include <sstream>
+#include <type_traits>
 
 namespace l3pp {
 
+namespace detail {
+	struct LoggerCache;
+}
+
 /**
  * LogStream is a logger object that can be streamed into, writing an entry
  * to the logger associated upon destruction. Instances of this classer are
@@ -23,10 +30,17 @@ class LogStream {
 	Logger& logger;
 	LogLevel level;
 	EntryContext context;
+	LogStatus* status;
 	mutable std::ostringstream stream;
-
-	LogStream(Logger& logger, LogLevel level, EntryContext context) :
-		logger(logger), level(level), context(context)
+#ifdef L3PP_ENABLE_ACCOUNTING
+	detail::OverheadSample sample;
+#endif
+
+	LogStream(Logger& logger, LogLevel level, EntryContext context, LogStatus* status = nullptr) :
+		logger(logger), level(level), context(context), status(status)
+#ifdef L3PP_ENABLE_ACCOUNTING
+		, sample(level != LogLevel::OFF ? &logger : nullptr)
+#endif
 	{
 	}
 
@@ -34,8 +48,12 @@ class LogStream {
 	LogStream& operator=(const LogStream&) = delete;
 public:
 	LogStream(LogStream&& other) :
-		logger(other.logger), level(other.level), context(std::move(other.context))/*,
+		logger(other.logger), level(other.level), context(std::move(other.context)),
+		status(other.status)/*,
 		stream(std::move(other.stream))*/
+#ifdef L3PP_ENABLE_ACCOUNTING
+		, sample(std::move(other.sample))
+#endif
 	{
 		stream.str(other.stream.str());
 	}
@@ -46,6 +64,21 @@ public:
 	friend LogStream const& operator<<(LogStream const& stream, std::ostream& (*F)(std::ostream&));
 };
 
+template<LogLevel Cap>
+class StaticLogger;
+
+/**
+ * Estimated cost of writing entries to a single sink, see
+ * Logger::estimateCost().
+ */
+struct SinkCost {
+	SinkPtr sink;
+	/// Average time to format an entry, in nanoseconds.
+	double nsPerRecord;
+	/// Average size of a formatted entry, in bytes.
+	double bytesPerRecord;
+};
+
 /**
  * Main logger class. Keeps track of all Logger instances, and can be used to
  * log various messages. Before the logging library is used, make sure to
@@ -63,8 +96,12 @@ public:
  * is logged. For convenience, various logging macros are defined at the end
  * of this header.
  */
-class Logger {
+class Logger : public std::enable_shared_from_this<Logger> {
 	friend class Formatter;
+	template<LogLevel Cap>
+	friend class StaticLogger;
+	friend class RequestScope;
+	friend struct detail::LoggerCache;
 
 	typedef std::shared_ptr<Logger> LogPtr;
 
@@ -73,23 +110,37 @@ class Logger {
 	LogLevel level;
 	std::vector<SinkPtr> sinks;
 	bool additive;
+	/// Lowest level that can be enabled, see StaticLogger.
+	LogLevel cap;
+	/// Time of the last lookup by name, in ticks of the steady clock. Lookups
+	/// that hit the cache of a thread record it when they leave the cache.
+	std::atomic<std::chrono::steady_clock::rep> lastUsed;
+	/// Whether the level, sinks or additivity were ever set, guarded by the
+	/// logger registry. Configured loggers are never evicted.
+	bool configured;
 
 	// Logger constructors are private
 	Logger() : parent(nullptr), name(""), level(LogLevel::DEFAULT),
-		additive(true)
+		additive(true), cap(LogLevel::ALL), lastUsed(0), configured(true)
 	{
 
 	}
 
 	Logger(std::string const& name, LogPtr parent) : parent(parent), name(name),
-		level(LogLevel::INHERIT), additive(true)
+		level(LogLevel::INHERIT), additive(true), cap(LogLevel::ALL), lastUsed(0), configured(false)
 	{
 	}
 
 	void logEntry(EntryContext const& context, std::string const& msg);
+	LogStatus tryLogEntry(EntryContext const& context, std::string const& msg);
+
+	void setConfigured();
+	static LogPtr getLoggerLocked(std::string const& name);
+	static std::size_t evictLocked(std::chrono::steady_clock::time_point now);
 
 public:
 	void addSink(SinkPtr sink) {
+		setConfigured();
 		sinks.push_back(sink);
 	}
 
@@ -99,14 +150,29 @@ public:
 		if (level == LogLevel::INHERIT && !parent) {
 			return;
 		}
+		setConfigured();
 		this->level = level;
 	}
 
+	/**
+	 * Returns the effective level, which is never lower than the level cap.
+	 */
 	LogLevel getLevel() const {
-		if (level == LogLevel::INHERIT) {
-			return parent->getLevel();
-		}
-		return level;
+		LogLevel effective = level == LogLevel::INHERIT ? parent->getLevel() : level;
+		return effective < cap ? cap : effective;
+	}
+
+	/**
+	 * Returns whether entries of the given level are logged on the current
+	 * thread, taking ScopedVerbosity into account.
+	 */
+	bool isEnabled(LogLevel level) const;
+
+	/**
+	 * Returns the lowest level this logger can be set to, see StaticLogger.
+	 */
+	LogLevel getLevelCap() const {
+		return cap;
 	}
 
 	std::string const& getName() const {
@@ -118,6 +184,7 @@ public:
 	}
 
 	void setAdditive(bool additive) {
+		setConfigured();
 		this->additive = additive;
 	}
 
@@ -144,6 +211,57 @@ public:
 
 	LogStream log(LogLevel level, EntryContext context = EntryContext());
 
+	/**
+	 * Logs a message like log(), but asks the sinks not to wait for their
+	 * output (see Sink::tryLog()).
+	 * @return Whether the entry was written, filtered or dropped.
+	 */
+	LogStatus tryLog(LogLevel level, std::string const& msg, EntryContext context = EntryContext());
+
+	/**
+	 * Stream variant of tryLog(). The status is stored once the returned
+	 * stream is destroyed, i.e. after the full logging expression.
+	 */
+	LogStream tryLog(LogLevel level, LogStatus& status, EntryContext context = EntryContext());
+
+	/**
+	 * Estimates the cost of entries of this logger with the current
+	 * configuration. Synthetic entries are formatted by every sink they
+	 * would be passed to (i.e. the sinks of this logger and, while
+	 * additive, its parents) and the output is discarded. Sinks that pass
+	 * entries on to another sink, like AsyncSink, are measured with the
+	 * formatter of that sink. The level of the logger and filtering by the
+	 * sinks are ignored, and the cost of the actual output is not included.
+	 * @param level Level of the synthetic entries.
+	 * @param records Number of entries to format per sink.
+	 * @param messageSize Size of the synthetic messages in bytes.
+	 * @return Cost per sink, in the order entries are passed to them.
+	 */
+	std::vector<SinkCost> estimateCost(LogLevel level, std::size_t records = 1000, std::size_t messageSize = 64) const;
+
+	/**
+	 * Sets the minimum level of entries for which a stack trace is captured,
+	 * see StackTrace. By default, no stack traces are captured.
+	 */
+	static void setStackTraceLevel(LogLevel level);
+
+	static LogLevel getStackTraceLevel();
+
+	/**
+	 * Sets the maximum number of elements printed when streaming a
+	 * container into a LogStream. Further elements are summarized as
+	 * "...(+N more)".
+	 */
+	static void setContainerLimit(std::size_t limit);
+
+	static std::size_t getContainerLimit();
+
+	/**
+	 * Number of entries logged by the L3PP_TRYLOG_* macros on the current
+	 * thread that were dropped.
+	 */
+	static std::size_t getDroppedCount();
+
 	LogStream trace(EntryContext context = EntryContext()) {
 		return log(LogLevel::TRACE, context);
 	}
@@ -172,10 +290,189 @@ public:
 		return logger;
 	}
 
+	/**
+	 * Returns the logger of the given name, creating it and its parents if
+	 * necessary. Each thread caches its recent lookups, such that repeated
+	 * lookups do not lock the registry. Such a cache keeps its loggers alive
+	 * after deinitialize() until the thread looks up a logger again or exits.
+	 */
 	static LogPtr getLogger(std::string name);
+
+	template<LogLevel Cap>
+	static LogPtr getLogger(StaticLogger<Cap> const& logger) {
+		return logger.get();
+	}
+
+	/**
+	 * Enables evicting loggers that were created by getLogger(), but were
+	 * never configured (setLevel(), addSink() or setAdditive() was not
+	 * called), are not referenced outside of the registry and have not been
+	 * looked up for the given time. This bounds the number of loggers when
+	 * logger names are generated dynamically, e.g. per request or session.
+	 * Evicted loggers are simply recreated when they are used again.
+	 * Loggers in the lookup cache of a thread, see getLogger(), are not
+	 * evicted. Each eviction releases these caches by the next lookup of
+	 * their threads, so such loggers are evicted by a later one.
+	 * Eviction is checked whenever a new logger is created, at most once per
+	 * idle time. A time of zero (the default) disables eviction.
+	 */
+	static void setIdleEviction(std::chrono::steady_clock::duration idle);
+
+	static std::chrono::steady_clock::duration getIdleEviction();
+
+	/**
+	 * Evicts all loggers that are idle as described by setIdleEviction().
+	 * Does nothing if eviction is disabled.
+	 * @return Number of evicted loggers.
+	 */
+	static std::size_t evictIdleLoggers();
 };
 typedef std::shared_ptr<Logger> LogPtr;
 
+/**
+ * Handle of a statically declared logger with a maximum verbosity that is
+ * known at compile time. The logging macros discard entries below the cap
+ * at compile time when used with a StaticLogger, and the logger itself never
+ * enables a level below the cap at runtime, i.e. Logger::setLevel() can only
+ * restrict it further. Other loggers are not affected, e.g. sub-loggers
+ * obtained by name may still log at lower levels when configured to.
+ * Usually declared with L3PP_DECLARE_LOGGER, e.g.
+ * @code{.cpp}
+ * #ifdef NDEBUG
+ * L3PP_DECLARE_LOGGER(hotpath, "app.hotpath", l3pp::LogLevel::INFO);
+ * #else
+ * L3PP_DECLARE_LOGGER(hotpath, "app.hotpath", l3pp::LogLevel::ALL);
+ * #endif
+ * L3PP_LOG_DEBUG(hotpath, "removed in release builds");
+ * @endcode
+ */
+template<LogLevel Cap>
+class StaticLogger {
+	LogPtr logger;
+
+public:
+	explicit StaticLogger(std::string const& name) : logger(Logger::getLogger(name)) {
+		// Several declarations of the same logger use the strictest cap
+		if (logger->cap < Cap) {
+			logger->cap = Cap;
+		}
+	}
+
+	static constexpr LogLevel getCap() {
+		return Cap;
+	}
+
+	LogPtr const& get() const {
+		return logger;
+	}
+
+	Logger* operator->() const {
+		return logger.get();
+	}
+};
+
+/**
+ * Lowers the effective level of a logger and its sub-loggers for the current
+ * thread while in scope, e.g. to trace a single request:
+ * @code{.cpp}
+ * l3pp::ScopedVerbosity verbosity(l3pp::LogLevel::TRACE, "app.db");
+ * @endcode
+ * Other threads are not affected. An empty name refers to all loggers.
+ * Scopes may be nested, the innermost scope that names a logger applies.
+ * The level caps of StaticLoggers still apply.
+ * While no scope is active, checking for overrides costs a single test of a
+ * thread-local flag, and only for entries that the logger level filters.
+ */
+class ScopedVerbosity {
+public:
+	ScopedVerbosity(LogLevel level, std::string const& logger);
+	~ScopedVerbosity();
+
+	ScopedVerbosity(ScopedVerbosity const&) = delete;
+	ScopedVerbosity& operator=(ScopedVerbosity const&) = delete;
+};
+
+/**
+ * Holds back all entries logged by the current thread while in scope, to
+ * decide at the end of a request whether they are worth writing, e.g.
+ * @code{.cpp}
+ * l3pp::RequestScope scope(l3pp::LogLevel::DEBUG);
+ * handle(request);
+ * if (request.failed() || request.slow()) {
+ *     scope.keep();
+ * }
+ * @endcode
+ * Held entries are copied into an arena of the thread, which is reused for
+ * the next request unless it grew large. Kept entries are written together,
+ * in order, once the outermost scope is kept; discarded entries cost only
+ * the copy.
+ * Held entries count against the MemoryBudget. Once it is exhausted, entries
+ * below its drop level are dropped, and other entries are written right away
+ * instead of being held back, like by Logger::tryLog(): as only the end of
+ * the scope frees its memory, sinks drop them rather than wait for memory.
+ * Nested scopes decide on their own entries: keeping passes them on to the
+ * enclosing scope, discarding drops them.
+ * A scope that is destroyed without a decision keeps its entries if one of
+ * them has level ERR or higher, and discards them otherwise.
+ */
+class RequestScope {
+	/// Index of the first entry, and offset of its message, in the arena.
+	std::size_t first;
+	std::size_t offset;
+	bool verbosity;
+	bool decided;
+
+	void enter();
+
+public:
+	/**
+	 * Holds back entries that pass the usual levels.
+	 */
+	RequestScope();
+
+	/**
+	 * Holds back entries of at least the given level from any logger of
+	 * the current thread, see ScopedVerbosity.
+	 */
+	explicit RequestScope(LogLevel level);
+
+	~RequestScope();
+
+	RequestScope(RequestScope const&) = delete;
+	RequestScope& operator=(RequestScope const&) = delete;
+
+	/**
+	 * Writes the entries of this scope, or passes them on to the
+	 * enclosing scope.
+	 */
+	void keep();
+
+	/**
+	 * Drops the entries of this scope.
+	 */
+	void discard();
+};
+
+namespace detail {
+	/**
+	 * Internal trait to get the compile-time level cap of the logger argument
+	 * of the logging macros.
+	 */
+	template<typename T>
+	struct LevelCap {
+		static constexpr LogLevel get() {
+			return LogLevel::ALL;
+		}
+	};
+
+	template<LogLevel Cap>
+	struct LevelCap<StaticLogger<Cap>> {
+		static constexpr LogLevel get() {
+			return Cap;
+		}
+	};
+}
+
 	/**
  * Helper class to initialize l3pp. Call get() will
  * retrieve the singleton, which will initialize the
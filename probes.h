@@ -0,0 +1,105 @@
+/**
+ * @file probes.h
+ *
+ * Optional USDT (user-level statically defined tracing) probes at the
+ * dispatch points of the library.
+ *
+ * Probes are compiled in if `L3PP_ENABLE_USDT` is defined and the platform
+ * is supported (Linux on x86-64 or AArch64 with GCC or clang). They follow
+ * the SystemTap `sdt.h` note format, so tools like `perf`, `bpftrace` or
+ * `stap` can list and attach to them without any library dependency:
+ * @code
+ * bpftrace -e 'usdt:./app:l3pp:write_end { @[str(arg0)] = sum(arg2); }'
+ * @endcode
+ * Every probe is guarded by a semaphore that the tracer increments when
+ * attaching. Without a tracer, a probe costs a single predictable branch and
+ * its arguments are not evaluated.
+ *
+ * All probes carry the same arguments: the logger name (`char const*`), the
+ * log level (as integer) and a size in bytes. The following probes exist:
+ * <ul>
+ * <li>`record_create`: an entry passed the logger level, size of the message.</li>
+ * <li>`level_reject`: an entry was filtered by the logger level, size 0.</li>
+ * <li>`format_start`: a sink starts formatting, size of the message.</li>
+ * <li>`format_end`: a sink finished formatting, size of the formatted entry.</li>
+ * <li>`write_start`: a sink starts writing, size of the formatted entry.</li>
+ * <li>`write_end`: a sink finished writing, size of the formatted entry.</li>
+ * <li>`enqueue`: an AsyncSink queued an entry, size of the message.</li>
+ * <li>`dequeue`: an AsyncSink took an entry from its queue for formatting,
+ * size of the message.</li>
+ * </ul>
+ */
+
+#pragma once
+
+#if defined(L3PP_ENABLE_USDT) && defined(__linux__) && defined(__GNUC__) && \
+	(defined(__x86_64__) || defined(__aarch64__))
+
+/// Name of the semaphore of a probe.
+#define __L3PP_PROBE_SEMAPHORE(name) l3pp_##name##_semaphore
+
+/**
+ * Defines the semaphore of a probe. Semaphores are weak, such that every
+ * translation unit may define them, and hidden, such that every module has
+ * its own set, as expected by the tracers.
+ */
+#define __L3PP_PROBE_DEFINE(name) \
+	extern "C" { \
+		__attribute__((weak, used, section(".probes"), visibility("hidden"))) \
+		volatile unsigned short __L3PP_PROBE_SEMAPHORE(name) = 0; \
+	}
+
+__L3PP_PROBE_DEFINE(record_create)
+__L3PP_PROBE_DEFINE(level_reject)
+__L3PP_PROBE_DEFINE(format_start)
+__L3PP_PROBE_DEFINE(format_end)
+__L3PP_PROBE_DEFINE(write_start)
+__L3PP_PROBE_DEFINE(write_end)
+__L3PP_PROBE_DEFINE(enqueue)
+__L3PP_PROBE_DEFINE(dequeue)
+
+/**
+ * Emits a probe site: a nop instruction and a `.note.stapsdt` entry that
+ * describes its location, semaphore and arguments.
+ */
+#define __L3PP_PROBE_SITE(name, logger, level, size) \
+	__asm__ __volatile__ ( \
+		"990: nop\n" \
+		".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+		".balign 4\n" \
+		".4byte 992f-991f, 994f-993f, 3\n" \
+		"991: .asciz \"stapsdt\"\n" \
+		"992: .balign 4\n" \
+		"993: .8byte 990b\n" \
+		".8byte _.stapsdt.base\n" \
+		".8byte l3pp_" #name "_semaphore\n" \
+		".asciz \"l3pp\"\n" \
+		".asciz \"" #name "\"\n" \
+		".asciz \"8@%0 -8@%1 8@%2\"\n" \
+		"994: .balign 4\n" \
+		".popsection\n" \
+		".ifndef _.stapsdt.base\n" \
+		".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+		".weak _.stapsdt.base\n" \
+		".hidden _.stapsdt.base\n" \
+		"_.stapsdt.base: .space 1\n" \
+		".size _.stapsdt.base, 1\n" \
+		".popsection\n" \
+		".endif\n" \
+		:: "nor"(reinterpret_cast<unsigned long long>(static_cast<char const*>(logger))), \
+		   "nor"(static_cast<long long>(level)), \
+		   "nor"(static_cast<unsigned long long>(size)))
+
+/// Fires the given probe if a tracer is attached.
+#define L3PP_PROBE(name, logger, level, size) do { \
+	if (__builtin_expect(__L3PP_PROBE_SEMAPHORE(name) != 0, 0)) { \
+		__L3PP_PROBE_SITE(name, logger, level, size); \
+	} \
+} while(false)
+
+#else
+
+/// Probes are disabled.
+#define L3PP_PROBE(name, logger, level, size) do { } while(false)
+
+#endif
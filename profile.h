@@ -0,0 +1,130 @@
+/**
+ * @file profile.h
+ *
+ * Defines classes to record the logging activity of a process and replay it
+ * against an arbitrary configuration.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace l3pp {
+
+/**
+ * Compact description of the logging activity of a process: how often each
+ * call site logs, how large the messages are and how much time passes
+ * between two entries of the same thread. Sizes and times are kept as
+ * histograms with power-of-two buckets, i.e. bucket k counts values in
+ * [2^(k-1), 2^k), and bucket 0 counts zeros.
+ * Profiles are recorded by a ProfileSink, can be saved and loaded, and can
+ * be replayed to drive any configuration of loggers and sinks with a
+ * realistic load.
+ */
+struct LoadProfile {
+	enum : std::size_t {
+		/// Number of histogram buckets.
+		Buckets = 64
+	};
+
+	/**
+	 * A location that emitted log entries.
+	 */
+	struct CallSite {
+		std::string filename;
+		std::size_t line;
+		std::string funcname;
+		std::string logger;
+		LogLevel level;
+		/// Number of entries emitted.
+		std::uint64_t count;
+	};
+
+	/**
+	 * Result of a replay.
+	 */
+	struct ReplayResult {
+		std::uint64_t entries;
+		std::chrono::nanoseconds duration;
+
+		double nsPerEntry() const {
+			return entries ? static_cast<double>(duration.count()) / entries : 0;
+		}
+	};
+
+	std::vector<CallSite> sites;
+	/// Histogram of message sizes in bytes.
+	std::vector<std::uint64_t> sizes;
+	/// Histogram of nanoseconds between two entries of a thread.
+	std::vector<std::uint64_t> gaps;
+	/// Number of threads that emitted entries.
+	unsigned threads;
+
+	LoadProfile() : sizes(Buckets), gaps(Buckets), threads(0) {
+	}
+
+	/**
+	 * Writes the profile in a line-based text format.
+	 */
+	void save(std::ostream& os) const;
+
+	/**
+	 * Reads a profile written by save(). Returns an empty profile if the
+	 * input is not a valid profile.
+	 */
+	static LoadProfile load(std::istream& is);
+
+	/**
+	 * Emits entries according to the profile: call sites, levels and
+	 * message sizes are drawn from their distribution, and every thread
+	 * waits for a gap drawn from the gap histogram before each entry.
+	 * The profile must outlive any asynchronous processing of the entries.
+	 * @param entries Total number of entries to emit.
+	 * @param threads Number of threads, or 0 to use as many as recorded.
+	 * @param timed Whether to wait between entries, or to emit at full speed.
+	 */
+	ReplayResult replay(std::uint64_t entries, unsigned threads = 0, bool timed = true) const;
+};
+
+/**
+ * Sink that records a LoadProfile of all entries it receives instead of
+ * writing them. Attach it to the root logger to profile a process; note that
+ * entries filtered by the logger levels are not seen.
+ */
+class ProfileSink: public Sink {
+	typedef std::tuple<std::string, std::size_t, std::string, std::string, LogLevel> SiteKey;
+
+	mutable std::mutex mutex;
+	mutable std::map<SiteKey, std::uint64_t> sites;
+	mutable std::map<std::thread::id, std::chrono::steady_clock::time_point> lastEntry;
+	mutable LoadProfile profile;
+
+	ProfileSink() {
+	}
+
+public:
+	void log(EntryContext const& context, std::string const& message) const override;
+
+	/**
+	 * Returns the profile recorded so far.
+	 */
+	LoadProfile getProfile() const;
+
+	/**
+	 * Create a ProfileSink.
+	 */
+	static std::shared_ptr<ProfileSink> create() {
+		return std::shared_ptr<ProfileSink>(new ProfileSink());
+	}
+};
+
+}
@@ -0,0 +1,119 @@
+/**
+ * @file shipper.h
+ *
+ * Defines the LogShipper class, which forwards log files to a collector
+ * socket.
+ */
+
+#pragma once
+
+#if defined(__linux__)
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace l3pp {
+
+/**
+ * Forwards log files to a local or remote collector. A background thread
+ * periodically sends new data of the registered files to a socket with
+ * `sendfile`, such that the data does not pass through user space.
+ * Completed files (see ship()) are sent up to their end, followed files
+ * (see follow()) are sent as they grow, e.g. the file of a StreamSink.
+ * All files share one connection, so only whole lines are sent: a followed
+ * file is sent up to its last newline, and a newline is added after a
+ * completed file that does not end with one.
+ * The offset up to which each file was sent is persisted in a small state
+ * file, such that shipping resumes where it stopped after a restart. If a
+ * file is replaced (i.e. has a different inode) or truncated, it is sent
+ * from the start.
+ * If the collector is not reachable, the shipper reconnects on its next
+ * pass. Only available on Linux.
+ */
+class LogShipper {
+	struct File {
+		/// Whether the file is complete, i.e. is forgotten once deleted.
+		bool complete;
+		std::uint64_t inode;
+		std::uint64_t offset;
+	};
+
+	std::string destination;
+	std::string stateFile;
+	std::chrono::milliseconds interval;
+
+	/// Guards files and the state file.
+	mutable std::mutex mutex;
+	std::condition_variable wakeup;
+	std::map<std::string, File> files;
+	/// Serializes passes, and guards socket. Files are sent without
+	/// holding mutex, such that registering files does not wait for the
+	/// network.
+	std::mutex transferMutex;
+	int socket;
+	bool stopping;
+	std::thread thread;
+
+	bool connect();
+	void disconnect();
+	bool send(std::string const& filename, File& file);
+	bool sendAll(char const* data, std::size_t size);
+	void loadState();
+	void saveState() const;
+	void run();
+
+public:
+	/**
+	 * Creates a shipper and starts its thread.
+	 * @param destination Collector address, either `unix:<path>` or
+	 *   `tcp:<host>:<port>`.
+	 * @param stateFile File to persist offsets in.
+	 * @param interval Time between two passes over the files.
+	 */
+	LogShipper(std::string const& destination, std::string const& stateFile,
+			std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+
+	/**
+	 * Stops the thread. Data that was not sent yet is sent by the next
+	 * shipper that uses the same state file.
+	 */
+	~LogShipper();
+
+	LogShipper(LogShipper const&) = delete;
+	LogShipper& operator=(LogShipper const&) = delete;
+
+	/**
+	 * Registers a completed file. It is sent up to its end, and removed
+	 * from the state once the file is deleted.
+	 */
+	void ship(std::string const& filename);
+
+	/**
+	 * Registers a file that is still written to. New data is sent on every
+	 * pass until unfollow() is called.
+	 */
+	void follow(std::string const& filename);
+
+	void unfollow(std::string const& filename);
+
+	/**
+	 * Sends all pending data on the calling thread, without waiting for
+	 * the next pass.
+	 * @return Whether all registered files were sent up to their end.
+	 */
+	bool transfer();
+
+	/**
+	 * Returns the offset up to which the given file was sent.
+	 */
+	std::uint64_t getOffset(std::string const& filename) const;
+};
+
+}
+
+#endif
@@ -0,0 +1,102 @@
+/**
+ * @file signalsafe.h
+ *
+ * Defines the SignalSafeEntry class, which can be used to log from signal
+ * handlers.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace l3pp {
+
+/**
+ * Log entry that may be written from a signal handler. Loggers, sinks and
+ * LogStream allocate memory and take locks, so they must not be used in
+ * signal handlers. A SignalSafeEntry instead collects preformatted strings,
+ * characters, integers and pointers in a fixed buffer on the stack and
+ * writes it to a file descriptor with a single `write` when it is destroyed.
+ * It never allocates or locks, and preserves errno. The entry uses the
+ * format of the default Formatter, i.e. "LEVEL - message\n", and is
+ * truncated to Capacity bytes. For example:
+ * @code{.cpp}
+ * void onSignal(int signal) {
+ *     l3pp::SignalSafeEntry(l3pp::LogLevel::WARN) << "received signal " << signal;
+ * }
+ * @endcode
+ * Entries are not filtered by any logger level. Up to `PIPE_BUF` bytes are
+ * written atomically to pipes, so entries are not interleaved with output
+ * of other threads written in single calls as well.
+ */
+class SignalSafeEntry {
+public:
+	enum : std::size_t {
+		/// Maximum size of an entry, including the trailing newline.
+		Capacity = 512
+	};
+
+private:
+	char buffer[Capacity];
+	std::size_t size;
+	int fd;
+
+	void appendUnsigned(unsigned long long value, unsigned base);
+
+public:
+	/**
+	 * Starts an entry.
+	 * @param level Level of the entry.
+	 * @param fd File descriptor to write to, or -1 for getFd().
+	 */
+	explicit SignalSafeEntry(LogLevel level, int fd = -1);
+
+	/**
+	 * Writes the entry.
+	 */
+	~SignalSafeEntry();
+
+	SignalSafeEntry(SignalSafeEntry const&) = delete;
+	SignalSafeEntry& operator=(SignalSafeEntry const&) = delete;
+
+	/**
+	 * Appends a span of bytes.
+	 */
+	SignalSafeEntry& append(char const* data, std::size_t length);
+
+	SignalSafeEntry& operator<<(char const* str);
+
+	SignalSafeEntry& operator<<(char c) {
+		return append(&c, 1);
+	}
+
+	/**
+	 * Appends a pointer in hexadecimal, e.g. a fault address.
+	 */
+	SignalSafeEntry& operator<<(void const* pointer);
+
+	template<typename T>
+	typename std::enable_if<std::is_integral<T>::value, SignalSafeEntry&>::type
+	operator<<(T value) {
+		if (std::is_signed<T>::value && value < T(0)) {
+			append("-", 1);
+			// Negate in the unsigned type, which also works for the minimum
+			appendUnsigned(0ull - static_cast<unsigned long long>(value), 10);
+		} else {
+			appendUnsigned(static_cast<unsigned long long>(value), 10);
+		}
+		return *this;
+	}
+
+	/**
+	 * Sets the file descriptor entries are written to by default. Initially,
+	 * this is standard error.
+	 */
+	static void setFd(int fd);
+
+	static int getFd();
+};
+
+}
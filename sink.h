@@ -6,11 +6,24 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
 #include <ostream>
 #include <fstream>
+#include <unordered_map>
 
 namespace l3pp {
 
+namespace detail {
+	/**
+	 * Internal function to get the name of a possibly unset logger.
+	 */
+	inline char const* GetLoggerName(Logger const* logger);
+}
+
 /**
  * Base class for a logging sink. It can only log some log entry to which some
  * formatting is applied (see Formatter).
@@ -39,13 +52,41 @@ public:
 	}
 
 	std::string formatMessage(EntryContext const& context, std::string const& message) const {
-		return (*formatter)(context, message);
+		L3PP_PROBE(format_start, detail::GetLoggerName(context.logger), context.level, message.size());
+		std::string formatted = (*formatter)(context, message);
+		L3PP_PROBE(format_end, detail::GetLoggerName(context.logger), context.level, formatted.size());
+		return formatted;
 	}
 
 	/**
 	 * Logs the given message with context info
 	 */
 	virtual void log(EntryContext const& context, std::string const& message) const = 0;
+
+	/**
+	 * Tries to log the given message without waiting for the output to
+	 * become available. By default, this simply calls log().
+	 * @return False if the entry was dropped.
+	 */
+	virtual bool tryLog(EntryContext const& context, std::string const& message) const {
+		log(context, message);
+		return true;
+	}
+
+	/**
+	 * Writes an entry that was already formatted with this sink's
+	 * formatter, e.g. by an AsyncSink. Sinks that do not override this
+	 * simply log (and thus format) the message again.
+	 * The output does not need to be flushed, see flush().
+	 */
+	virtual void write(EntryContext const& context, std::string const& message, std::string const&) const {
+		log(context, message);
+	}
+
+	/**
+	 * Flushes output written by write().
+	 */
+	virtual void flush() const {}
 };
 typedef std::shared_ptr<Sink> SinkPtr;
 
@@ -80,8 +121,41 @@ class StreamSink: public Sink {
 public:
 	void log(EntryContext const& context, std::string const& message) const override {
 		if (context.level >= this->level) {
-			*os << formatMessage(context, message) << std::flush;
+			std::string formatted = formatMessage(context, message);
+			L3PP_PROBE(write_start, detail::GetLoggerName(context.logger), context.level, formatted.size());
+			*os << formatted << std::flush;
+			L3PP_PROBE(write_end, detail::GetLoggerName(context.logger), context.level, formatted.size());
+		}
+	}
+
+	/**
+	 * Drops the entry if the stream is in an error state, and does not
+	 * flush the stream after writing.
+	 */
+	bool tryLog(EntryContext const& context, std::string const& message) const override {
+		if (context.level < this->level) {
+			return true;
 		}
+		if (!*os) {
+			return false;
+		}
+		std::string formatted = formatMessage(context, message);
+		L3PP_PROBE(write_start, detail::GetLoggerName(context.logger), context.level, formatted.size());
+		*os << formatted;
+		L3PP_PROBE(write_end, detail::GetLoggerName(context.logger), context.level, formatted.size());
+		return !os->fail();
+	}
+
+	void write(EntryContext const& context, std::string const&, std::string const& formatted) const override {
+		if (context.level >= this->level) {
+			L3PP_PROBE(write_start, detail::GetLoggerName(context.logger), context.level, formatted.size());
+			*os << formatted;
+			L3PP_PROBE(write_end, detail::GetLoggerName(context.logger), context.level, formatted.size());
+		}
+	}
+
+	void flush() const override {
+		os->flush();
 	}
 
 	/**
@@ -101,5 +175,214 @@ public:
 	}
 };
 
+/**
+ * Logging sink that writes to a file of fixed size, overwriting the oldest
+ * entries once the file is full. The file is allocated completely when it
+ * is created and never grows, shrinks or is renamed.
+ * The file starts with a small header that records the position of the
+ * next write, such that the sink can continue an existing file and read()
+ * can reconstruct the entries in chronological order. Entries are expected
+ * to end with a newline, as produced by the default formatters.
+ */
+class CircularFileSink: public Sink {
+public:
+	enum : std::size_t {
+		/// Size of the file header.
+		HeaderSize = 32
+	};
+
+private:
+	/// Filtered loglevel
+	LogLevel level;
+	/// Guards the file and the write position against concurrent entries.
+	mutable std::mutex mutex;
+	/// Output file.
+	mutable std::fstream file;
+	/// Size of the data area after the header.
+	std::uint64_t capacity;
+	/// Offset of the next write into the data area.
+	mutable std::uint64_t head;
+	/// Whether the data area was filled completely at least once.
+	mutable bool wrapped;
+
+	CircularFileSink(std::string const& filename, std::uint64_t size);
+
+	void writeData(char const* data, std::size_t size) const;
+	void writeHeader() const;
+
+public:
+	LogLevel getLevel() const {
+		return level;
+	}
+
+	void setLevel(LogLevel level) {
+		this->level = level;
+	}
+
+	void log(EntryContext const& context, std::string const& message) const override;
+	void write(EntryContext const& context, std::string const& message, std::string const& formatted) const override;
+
+	/**
+	 * Create a CircularFileSink. An existing file of the same size is
+	 * continued, otherwise the file is created anew.
+	 * @param filename Filename for output file.
+	 * @param size Total size of the file in bytes, including the header.
+	 */
+	static SinkPtr create(std::string const& filename, std::uint64_t size) {
+		return SinkPtr(new CircularFileSink(filename, size));
+	}
+
+	/**
+	 * Reads the entries of a file written by a CircularFileSink, oldest
+	 * first. If the file has wrapped, the oldest entry is omitted, as it
+	 * may have been overwritten partially.
+	 * @param filename Filename of the file.
+	 * @return The entries, or an empty string if the file is not valid.
+	 */
+	static std::string read(std::string const& filename);
+};
+
+/**
+ * Logging sink that writes each entry to one of many files, e.g. a file per
+ * tenant. The file is chosen by a function of the entry context, usually
+ * created from a path pattern, see makeRouter().
+ * Only a bounded number of files is open at a time: the least recently used
+ * file is closed when another one has to be opened, and files that were not
+ * used for the idle timeout are closed when entries are logged or on flush().
+ * Files are opened for appending, such that a closed file is continued when
+ * it is used again. Files that cannot be opened are skipped.
+ * Entries passed to write() (e.g. by an AsyncSink) are collected per file and
+ * written at once on flush(), or when the buffer of the file is full. The
+ * buffers count against the MemoryBudget; while it is exhausted, entries are
+ * written directly.
+ */
+class RoutingFileSink: public Sink {
+public:
+	/// Returns the path of the file an entry is written to.
+	typedef std::function<std::string(EntryContext const&)> Router;
+
+private:
+	/// How append() passes an entry to its file.
+	enum class WriteMode {
+		/// Write and flush the file.
+		FLUSH,
+		/// Write without flushing.
+		DIRECT,
+		/// Collect in the buffer of the file, see write().
+		BUFFERED
+	};
+
+	struct File {
+		std::string path;
+		std::ofstream stream;
+		/// Entries that were not passed to the stream yet.
+		std::string pending;
+		std::chrono::steady_clock::time_point lastUsed;
+	};
+
+	/// Filtered loglevel
+	LogLevel level;
+	Router router;
+	/// Maximum number of open files.
+	std::size_t maxOpen;
+	std::chrono::steady_clock::duration idleTimeout;
+	/// Size of the buffer of each file, see setBufferSize().
+	std::size_t bufferSize;
+
+	mutable std::mutex mutex;
+	/// Open files, most recently used first.
+	mutable std::list<File> files;
+	mutable std::unordered_map<std::string, std::list<File>::iterator> index;
+	/// Time when files were last checked for the idle timeout.
+	mutable std::chrono::steady_clock::time_point lastSweep;
+
+	RoutingFileSink(Router router, std::size_t maxOpen, std::chrono::steady_clock::duration idleTimeout);
+
+	/// Returns the open file for the path, or nullptr if it cannot be opened.
+	File* getFile(std::string const& path) const;
+	void writePending(File& file) const;
+	void close(std::list<File>::iterator it) const;
+	void closeIdle(std::chrono::steady_clock::time_point now) const;
+	bool append(EntryContext const& context, std::string const& formatted, WriteMode mode) const;
+
+public:
+	~RoutingFileSink();
+
+	LogLevel getLevel() const {
+		return level;
+	}
+
+	void setLevel(LogLevel level) {
+		this->level = level;
+	}
+
+	/**
+	 * Sets the number of bytes collected per file by write() before they
+	 * are passed to the file. By default, 64 KiB.
+	 * Must be called before the sink is used.
+	 */
+	void setBufferSize(std::size_t bytes) {
+		bufferSize = bytes;
+	}
+
+	/**
+	 * Writes and flushes the entry immediately.
+	 */
+	void log(EntryContext const& context, std::string const& message) const override;
+
+	/**
+	 * Writes the entry without flushing the file.
+	 * @return False if the file could not be opened or written.
+	 */
+	bool tryLog(EntryContext const& context, std::string const& message) const override;
+
+	void write(EntryContext const& context, std::string const& message, std::string const& formatted) const override;
+
+	void flush() const override;
+
+	/**
+	 * Returns the number of currently open files.
+	 */
+	std::size_t getOpenFiles() const;
+
+	/**
+	 * Creates a router from a path pattern. The following placeholders are
+	 * replaced:
+	 * <ul>
+	 * <li>`{logger}` by the name of the logger of the entry,</li>
+	 * <li>`{level}` by the level of the entry,</li>
+	 * <li>`{N}` by the N-th component (from 0) of the logger name, where
+	 * components are separated by dots, or nothing if it has fewer.</li>
+	 * </ul>
+	 * Path separators in replaced values, and values that consist of `.` or
+	 * `..`, are turned into underscores, such that a logger name cannot leave
+	 * the directory given by the pattern.
+	 * For example, `logs/{1}.log` writes the entries of logger
+	 * `tenant.acme.db` to `logs/acme.log`.
+	 */
+	static Router makeRouter(std::string const& pattern);
+
+	/**
+	 * Create a RoutingFileSink.
+	 * @param pattern Path pattern, see makeRouter().
+	 * @param maxOpen Maximum number of open files.
+	 * @param idleTimeout Time after which an unused file is closed, zero to
+	 *   keep files open until they are least recently used.
+	 */
+	static SinkPtr create(std::string const& pattern, std::size_t maxOpen = 64,
+			std::chrono::steady_clock::duration idleTimeout = std::chrono::seconds(60)) {
+		return SinkPtr(new RoutingFileSink(makeRouter(pattern), maxOpen, idleTimeout));
+	}
+
+	/**
+	 * Create a RoutingFileSink that chooses files by the given function.
+	 * Entries for which it returns an empty path are skipped.
+	 */
+	static SinkPtr create(Router router, std::size_t maxOpen = 64,
+			std::chrono::steady_clock::duration idleTimeout = std::chrono::seconds(60)) {
+		return SinkPtr(new RoutingFileSink(router, maxOpen, idleTimeout));
+	}
+};
+
 }
 
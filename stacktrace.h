@@ -0,0 +1,70 @@
+/**
+ * @file stacktrace.h
+ *
+ * Defines the StackTrace class, which holds the raw return addresses of a
+ * log entry.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+
+namespace l3pp {
+
+/**
+ * Raw stack trace of a log entry. Capturing only stores the return addresses,
+ * which is cheap. The addresses are symbolized when the trace is streamed,
+ * i.e. when a sink formats the entry, and symbols are cached per address.
+ * Stack traces are captured for entries with a level of at least
+ * Logger::getStackTraceLevel().
+ *
+ * Capturing is supported on glibc and macOS. Symbols of executables are
+ * only available if they were linked with `-rdynamic`, otherwise the module
+ * and offset are printed, which can be resolved offline, e.g. by addr2line.
+ */
+class StackTrace {
+public:
+	enum : std::size_t {
+		/// Maximum number of captured frames.
+		MaxDepth = 32
+	};
+
+private:
+	void* frames[MaxDepth];
+	std::size_t depth;
+
+	StackTrace() : depth(0) {
+	}
+
+public:
+	/**
+	 * Captures the stack of the calling thread.
+	 * @param skip Number of innermost frames to omit.
+	 */
+	static std::shared_ptr<StackTrace const> capture(std::size_t skip = 0);
+
+	std::size_t size() const {
+		return depth;
+	}
+
+	void* operator[](std::size_t index) const {
+		return frames[index];
+	}
+
+	/**
+	 * Symbolizes a single return address, see StackTrace.
+	 */
+	static std::string const& symbolize(void* address);
+};
+
+/**
+ * Streaming operator for StackTrace. Prints every frame on a new line.
+ * @param os Output stream.
+ * @param trace StackTrace.
+ * @return os.
+ */
+inline std::ostream& operator<<(std::ostream& os, StackTrace const& trace);
+
+}